@@ -1,4 +1,6 @@
 #include "analysis.h"
+#include "transient_support.h"
+#include "waveform.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +10,7 @@
 #include <string.h>
 #include <gsl/gsl_linalg.h>
 #include <math.h>
+#include <unistd.h>
 
 extern int debug_on;
 extern int force_sparse;
@@ -20,12 +23,399 @@ extern int force_sparse;
 #endif
 
 #define BI_CG_EPSILON 1e-14
+#define LU_SPARSE_TOL 1e-14
+#define BLOCK_MIN_SIZE 1024  //smaller components share a block, see sparse_blocks_init()
+
+//automatic storage selection, see get_sparse()
+#define DENSE_MAX_SIZE 100  //dense LU is as fast as sparse LU up to here
+#define DENSE_MIN_FILL 0.1  //fraction of nonzeros of a matrix that is dense anyway
+#define BAND_MAX_FILL 0.25  //fraction of a row the banded LU factors may take
+#define BAND_MAX_SIZE 8     //banded LU is faster than sparse LU up to this bandwidth
+
+static inline dfloat_t *analysis_workspace(struct analysis_info *analysis,
+                                           enum workspace_slot slot) {
+    unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
+    return &analysis->workspace[slot * mna_dim_size];
+}
 
 void fprint_dfloat_array(const char *filename,
                          unsigned long row, unsigned long col, dfloat_t *p);
-static unsigned long count_nonzeros(struct netlist_info *netlist);
 static void analyse_init_solver(struct analysis_info *analysis,enum solver _solver);
 
+//dense stamps, the sparse matrices are assembled by assemble_sparse()
+static inline dfloat_t *dense_entry(dfloat_t *M, unsigned long size,
+                                    const struct dense_band *band,
+                                    unsigned long row, unsigned long col) {
+    //band is NULL for full storage
+    if (!band)
+        return &M[row*size + col];
+    row = band->perm[row];
+    col = band->perm[col];
+    return &M[row*band->width + col + band->band - row];
+}
+
+static inline void stamp_add(dfloat_t *M, unsigned long size, const struct dense_band *band,
+                             unsigned long row, unsigned long col, dfloat_t value) {
+    *dense_entry(M,size,band,row,col) += value;
+}
+
+static inline void stamp_set(dfloat_t *M, unsigned long size, const struct dense_band *band,
+                             unsigned long row, unsigned long col, dfloat_t value) {
+    *dense_entry(M,size,band,row,col) = value;
+}
+
+static inline unsigned long dense_values(const struct analysis_info *analysis,
+                                         unsigned long size) {
+    //of a dense G or C
+    return analysis->use_band ? size * analysis->band.width : size * size;
+}
+
+static inline unsigned long decomp_values(const struct analysis_info *analysis,
+                                          unsigned long size) {
+    //of the dense factors
+    return analysis->use_band ? size * (3 * analysis->band.band + 1) : size * size;
+}
+
+static void stamp_passive(dfloat_t *M, unsigned long size, const struct dense_band *band,
+                          struct device_array *dev) {
+    //NOTE: ignore ground node, all rows are moved up by one
+    unsigned long k;
+    for (k=0; k<dev->size; ++k) {
+        unsigned long a = dev->vplus[k];
+        unsigned long b = dev->vminus[k];
+        dfloat_t value = dev->value[k];
+        if (a)
+            stamp_add(M,size,band,a - 1,a - 1,value);
+        if (b)
+            stamp_add(M,size,band,b - 1,b - 1,value);
+        if (a && b) {
+            stamp_add(M,size,band,a - 1,b - 1,-value);
+            stamp_add(M,size,band,b - 1,a - 1,-value);
+        }
+    }
+}
+
+static void stamp_branch(dfloat_t *M, unsigned long size, const struct dense_band *band,
+                         unsigned long _n, struct device_array *dev) {
+    //group2 element, populate A2 and A2 transposed
+    unsigned long k;
+    for (k=0; k<dev->size; ++k) {
+        unsigned long a = dev->vplus[k];
+        unsigned long b = dev->vminus[k];
+        unsigned long col = _n + dev->idx[k];
+        if (a) {
+            stamp_set(M,size,band,a - 1,col,+1);
+            stamp_set(M,size,band,col,a - 1,+1);
+        }
+        if (b) {
+            stamp_set(M,size,band,b - 1,col,-1);
+            stamp_set(M,size,band,col,b - 1,-1);
+        }
+    }
+}
+
+static void stamp_dense(dfloat_t *G, dfloat_t *C, unsigned long size,
+                        const struct dense_band *band, unsigned long _n,
+                        struct device_table *dev) {
+    //G, and C unless it is NULL, on zeroed dense storage
+    unsigned long k;
+    stamp_passive(G,size,band,&dev->r);
+    stamp_branch(G,size,band,_n,&dev->v);
+    stamp_branch(G,size,band,_n,&dev->l);
+    if (!C)
+        return;
+    stamp_passive(C,size,band,&dev->c);
+    for (k=0; k<dev->l.size; ++k) {
+        unsigned long col = _n + dev->l.idx[k];
+        stamp_set(C,size,band,col,col,-dev->l.value[k]);
+    }
+}
+
+/* Sparse assembly, straight to compressed columns. The same walk over the
+   device arrays counts the stamps of every column (CSC_COUNT), writes their
+   rows (CSC_ROWS) and, once the pattern is final, finds the entry of every
+   stamp (CSC_MAP). Stamps on the ground node are skipped, their map entry
+   is -1. */
+enum csc_mode {
+    CSC_COUNT = 0,
+    CSC_ROWS,
+    CSC_MAP
+};
+
+struct csc_pass {
+    enum csc_mode mode;
+    cs *A;
+    int *next;  //stamps per column, then the next free entry of each column
+};
+
+static inline int csc_find(cs *A, int row, int col) {
+    //the rows of every column are sorted
+    int lo = A->p[col];
+    int hi = A->p[col + 1] - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (A->i[mid] < row)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    assert(A->i[lo] == row);
+    return lo;
+}
+
+static inline void csc_put(struct csc_pass *pass, long row, long col, int *slot) {
+    //NOTE: ignore ground node, all rows are moved up by one
+    if (row < 0 || col < 0) {
+        *slot = -1;
+        return;
+    }
+    switch (pass->mode) {
+    case CSC_COUNT:  pass->next[col]++;                      break;
+    case CSC_ROWS:   pass->A->i[pass->next[col]++] = row;    break;
+    case CSC_MAP:    *slot = csc_find(pass->A,row,col);      break;
+    }
+}
+
+static void csc_passive(struct csc_pass *pass, struct device_array *dev, int *map) {
+    unsigned long k;
+    for (k=0; k<dev->size; ++k) {
+        long a = (long)dev->vplus[k] - 1;
+        long b = (long)dev->vminus[k] - 1;
+        int *slot = &map[4*k];
+        csc_put(pass,a,a,&slot[0]);
+        csc_put(pass,b,b,&slot[1]);
+        csc_put(pass,a,b,&slot[2]);
+        csc_put(pass,b,a,&slot[3]);
+    }
+}
+
+static void csc_branch(struct csc_pass *pass, unsigned long _n,
+                       struct device_array *dev, int *map) {
+    //group2 element, populate A2 and A2 transposed
+    unsigned long k;
+    for (k=0; k<dev->size; ++k) {
+        long a = (long)dev->vplus[k] - 1;
+        long b = (long)dev->vminus[k] - 1;
+        long col = _n + dev->idx[k];
+        int *slot = &map[4*k];
+        csc_put(pass,a,col,&slot[0]);
+        csc_put(pass,col,a,&slot[1]);
+        csc_put(pass,b,col,&slot[2]);
+        csc_put(pass,col,b,&slot[3]);
+    }
+}
+
+static void csc_branch_diag(struct csc_pass *pass, unsigned long _n,
+                            struct device_array *dev, int *map) {
+    unsigned long k;
+    for (k=0; k<dev->size; ++k) {
+        long col = _n + dev->idx[k];
+        csc_put(pass,col,col,&map[k]);
+    }
+}
+
+#define STAMP_G 1
+#define STAMP_C 2
+
+static void csc_walk(struct csc_pass *pass, unsigned long _n,
+                     struct device_table *dev, struct stamp_map *map) {
+    //stamp order, see restamp_sparse()
+    if (map->stamps & STAMP_G) {
+        csc_passive(pass,&dev->r,map->r);
+        csc_branch(pass,_n,&dev->v,map->v);
+        csc_branch(pass,_n,&dev->l,map->l);
+    }
+    if (map->stamps & STAMP_C) {
+        csc_passive(pass,&dev->c,map->c);
+        csc_branch_diag(pass,_n,&dev->l,map->l_diag);
+    }
+}
+
+static void csc_sort_column(int *Ai, int size) {
+    //shell sort, in place (columns are short, except for a few nets)
+    static const int gaps[] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+    unsigned int g;
+    for (g=0; g<sizeof(gaps)/sizeof(gaps[0]); ++g) {
+        int gap = gaps[g];
+        int i;
+        for (i=gap; i<size; ++i) {
+            int row = Ai[i];
+            int j = i;
+            for (; j >= gap && Ai[j - gap] > row; j -= gap)
+                Ai[j] = Ai[j - gap];
+            Ai[j] = row;
+        }
+    }
+}
+
+static int *stamp_map_alloc(unsigned long size) {
+    int *map = (int*)malloc(size * sizeof(int));
+    if (!map && size) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    return map;
+}
+
+static void stamp_passive_values(dfloat_t *Ax, int *map, struct device_array *dev,
+                                 const dfloat_t alpha) {
+    unsigned long k;
+    for (k=0; k<dev->size; ++k) {
+        dfloat_t value = alpha * dev->value[k];
+        int *slot = &map[4*k];
+        if (slot[0] >= 0)  Ax[slot[0]] += value;
+        if (slot[1] >= 0)  Ax[slot[1]] += value;
+        if (slot[2] >= 0)  Ax[slot[2]] -= value;
+        if (slot[3] >= 0)  Ax[slot[3]] -= value;
+    }
+}
+
+static void stamp_branch_values(dfloat_t *Ax, int *map, struct device_array *dev,
+                                const dfloat_t alpha) {
+    unsigned long k;
+    for (k=0; k<dev->size; ++k) {
+        int *slot = &map[4*k];
+        if (slot[0] >= 0)  Ax[slot[0]] += alpha;
+        if (slot[1] >= 0)  Ax[slot[1]] += alpha;
+        if (slot[2] >= 0)  Ax[slot[2]] -= alpha;
+        if (slot[3] >= 0)  Ax[slot[3]] -= alpha;
+    }
+}
+
+static void restamp_sparse(cs *A, struct stamp_map *map, struct device_table *dev,
+                           const dfloat_t alpha_g, const dfloat_t alpha_c) {
+    /* A = alpha_g * G + alpha_c * C, values only. A scatter through the
+       stamp map, nothing is allocated. A zero alpha skips its devices. */
+
+    unsigned long k;
+    memset(A->x,0,A->p[A->n] * sizeof(dfloat_t));
+    if ((map->stamps & STAMP_G) && alpha_g != 0) {
+        stamp_passive_values(A->x,map->r,&dev->r,alpha_g);
+        stamp_branch_values(A->x,map->v,&dev->v,alpha_g);
+        stamp_branch_values(A->x,map->l,&dev->l,alpha_g);
+    }
+    if ((map->stamps & STAMP_C) && alpha_c != 0) {
+        stamp_passive_values(A->x,map->c,&dev->c,alpha_c);
+        for (k=0; k<dev->l.size; ++k)
+            A->x[map->l_diag[k]] -= alpha_c * dev->l.value[k];
+    }
+}
+
+static cs *assemble_sparse(struct netlist_info *netlist, unsigned long size,
+                           const int stamps, struct stamp_map *map) {
+    /* The pattern of G (STAMP_G), C (STAMP_C) or both, without the triplet
+       form: count the stamps of every column, write their rows in place,
+       merge the duplicates and sort each column. Then map every stamp to
+       its entry, see restamp_sparse() for the values.
+
+       G: resistors and the A2 incidence of the group2 elements.
+       C: capacitors and -L on the diagonal of the inductor branches. */
+
+    unsigned long _n = netlist->n - 1;
+    struct device_table *dev = &netlist->devices;
+
+    memset(map,0,sizeof(struct stamp_map));
+    map->stamps = stamps;
+    if (stamps & STAMP_G) {
+        map->r = stamp_map_alloc(4 * dev->r.size);
+        map->v = stamp_map_alloc(4 * dev->v.size);
+        map->l = stamp_map_alloc(4 * dev->l.size);
+    }
+    if (stamps & STAMP_C) {
+        map->c = stamp_map_alloc(4 * dev->c.size);
+        map->l_diag = stamp_map_alloc(dev->l.size);
+    }
+
+    struct csc_pass pass;
+    pass.mode = CSC_COUNT;
+    pass.A = NULL;
+    pass.next = (int*)calloc(size + 1,sizeof(int));
+    if (!pass.next) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    csc_walk(&pass,_n,dev,map);
+
+    unsigned long j;
+    unsigned long nonzeros = 0;
+    for (j=0; j<size; ++j) {
+        int count = pass.next[j];
+        pass.next[j] = nonzeros;
+        nonzeros += count;
+    }
+
+    //see cs_spalloc()
+    printf("debug: trying to allocate %lu bytes ...\n",
+           sizeof(cs) + (size + 1) * sizeof(int) +
+           nonzeros * (sizeof(int) + sizeof(dfloat_t)));
+    cs *A = cs_spalloc(size,size,nonzeros,1,0);
+    if (!A) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(A->p,pass.next,size * sizeof(int));
+    A->p[size] = nonzeros;
+
+    pass.mode = CSC_ROWS;
+    pass.A = A;
+    csc_walk(&pass,_n,dev,map);
+
+    //merge the rows of each column, w[] marks the entry of a row
+    int *w = pass.next;
+    int nz = 0;
+    for (j=0; j<size; ++j)
+        w[j] = -1;
+    for (j=0; j<size; ++j) {
+        int begin = nz;
+        int p;
+        for (p=A->p[j]; p<A->p[j+1]; ++p) {
+            int row = A->i[p];
+            if (w[row] < begin) {
+                w[row] = nz;
+                A->i[nz++] = row;
+            }
+        }
+        A->p[j] = begin;
+        csc_sort_column(&A->i[begin],nz - begin);
+    }
+    A->p[size] = nz;
+    free(w);
+
+    if (!cs_sprealloc(A,0)) {
+        printf("cs_sprealloc() failed - exit.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pass.mode = CSC_MAP;
+    pass.next = NULL;
+    csc_walk(&pass,_n,dev,map);
+
+    return A;
+}
+
+static cs *cs_share_pattern(cs *A) {
+    //same p and i as A, own values, see cs_free_shared()
+    cs *B = (cs*)malloc(sizeof(cs));
+    if (!B) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    *B = *A;
+    B->x = (dfloat_t*)malloc(A->nzmax * sizeof(dfloat_t));
+    if (!B->x) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    return B;
+}
+
+static void cs_free_shared(cs *B) {
+    if (!B)
+        return;
+    free(B->x);
+    free(B);
+}
+
 void analysis_init(struct netlist_info *netlist, struct analysis_info *analysis) {
     const int use_sparse = analysis->use_sparse;
     const enum solver _solver = analysis->_solver;
@@ -48,42 +438,39 @@ void analysis_init(struct netlist_info *netlist, struct analysis_info *analysis)
     dfloat_t *decomp = NULL;
 
     if (use_sparse) {
-        unsigned long nonzeros = count_nonzeros(netlist);
-        //see cs_spalloc()
-        printf("debug: trying to allocate %lu bytes ...\n",
-               sizeof(cs) + 2*nonzeros * sizeof(int) + nonzeros*sizeof(dfloat_t));
-
-        cs_mna_matrix = cs_spalloc(mna_dim_size,mna_dim_size,nonzeros,1,1);
-        if (!cs_mna_matrix) {
-            perror(__FUNCTION__);
-            exit(EXIT_FAILURE);
-        }
-
+        /* G and C share the pattern of both, stamps are summed in stamp
+           order as cs_dupl() does. Every G + alpha * C is an axpy over
+           the values then. */
+        MSG("assembling sparse matrices ...")
         if (_transient_method != T_NONE) {
-            cs_transient_matrix = cs_spalloc(mna_dim_size,mna_dim_size,nonzeros,1,1);
-            if (!cs_transient_matrix) {
-                perror(__FUNCTION__);
-                exit(EXIT_FAILURE);
-            }
+            cs_mna_matrix = assemble_sparse(netlist,mna_dim_size,STAMP_G | STAMP_C,
+                                            &analysis->cs_map);
+            cs_transient_matrix = cs_share_pattern(cs_mna_matrix);
+            restamp_sparse(cs_transient_matrix,&analysis->cs_map,&netlist->devices,0,1);
         }
+        else
+            cs_mna_matrix = assemble_sparse(netlist,mna_dim_size,STAMP_G,
+                                            &analysis->cs_map);
+        restamp_sparse(cs_mna_matrix,&analysis->cs_map,&netlist->devices,1,0);
     }
     else {
+        unsigned long values = dense_values(analysis,mna_dim_size);
         printf("debug: trying to allocate %lu bytes ...\n",
-               mna_dim_size * mna_dim_size * sizeof(dfloat_t));
-        mna_matrix = (dfloat_t*)calloc(mna_dim_size*mna_dim_size,sizeof(dfloat_t));
+               values * sizeof(dfloat_t));
+        mna_matrix = (dfloat_t*)calloc(values,sizeof(dfloat_t));
         if (!mna_matrix) {
             perror(__FUNCTION__);
             exit(EXIT_FAILURE);
         }
 
-        decomp = (dfloat_t*)calloc(mna_dim_size*mna_dim_size,sizeof(dfloat_t));
+        decomp = (dfloat_t*)calloc(decomp_values(analysis,mna_dim_size),sizeof(dfloat_t));
         if (!decomp) {
             perror(__FUNCTION__);
             exit(EXIT_FAILURE);
         }
 
         if (_transient_method != T_NONE) {
-            transient_matrix = (dfloat_t *)calloc(mna_dim_size*mna_dim_size,sizeof(dfloat_t));
+            transient_matrix = (dfloat_t *)calloc(values,sizeof(dfloat_t));
             if (!transient_matrix) {
                 perror(__FUNCTION__);
                 exit(EXIT_FAILURE);
@@ -104,6 +491,14 @@ void analysis_init(struct netlist_info *netlist, struct analysis_info *analysis)
         exit(EXIT_FAILURE);
     }
 
+    //every scratch vector of the solvers and the time loops,
+    //nothing is allocated per solve or per timestep
+    dfloat_t *workspace = (dfloat_t*)malloc(W_SIZE*mna_dim_size*sizeof(dfloat_t));
+    if (!workspace) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
 #if 0
     dfloat_t *v = (dfloat_t*)calloc((_n), sizeof(dfloat_t));
     if (!v) {
@@ -120,149 +515,33 @@ void analysis_init(struct netlist_info *netlist, struct analysis_info *analysis)
 
     MSG("populating matrices ...")
 
-    unsigned long i;
-    unsigned long j;
-
-    //populate MNA Matrix
-
-    //NOTE: ignore ground node
-    //      all rows are moved up by one
-
-    for (i=1; i<=_n; ++i) {
-        struct node *_node = &netlist->node_pool[i];
-        unsigned long row  = _node->nuid - 1;
-        for (j=0; j<_node->refs; ++j) {
-            struct element *el = _node->attached_el[j]._el;
-            switch (el->type) {
-            case 'r': {
-                assert(_node == el->r->vplus._node || _node == el->r->vminus._node);
-                unsigned long this_node  = row;
-                unsigned long other_node = (_node != el->r->vplus._node) ? el->r->vplus.nuid : el->r->vminus.nuid;
-                dfloat_t value = 1/el->value;
-
-                if (use_sparse) {
-                    //diagonal entry
-                    cs_entry(cs_mna_matrix,this_node,this_node,value);
-                    //off diagonal entry
-                    if (other_node--)
-                        cs_entry(cs_mna_matrix,this_node,other_node,-value);
-                }
-                else {
-                    //diagonal entry
-                    mna_matrix[this_node*mna_dim_size + this_node] += value;
-                    //off diagonal entry
-                    if (other_node--)
-                        mna_matrix[this_node*mna_dim_size + other_node] += -value;
-                }
-                break;
-            }
-            case 'v': {
-                assert(_node == el->v->vplus._node || _node == el->v->vminus._node);
-                dfloat_t value = (_node == el->v->vplus._node) ? +1 : -1;
-
-                unsigned long col = _n + el->idx;
-
-                if (use_sparse) {
-                    //group2 element, populate A2
-                    cs_entry(cs_mna_matrix,row,col,value);
-                    //group2 element, populate A2 transposed
-                    cs_entry(cs_mna_matrix,col,row,value);
-                }
-                else {
-                    //group2 element, populate A2
-                    mna_matrix[row*mna_dim_size + col] = value;
-                    //group2 element, populate A2 transposed
-                    mna_matrix[col*mna_dim_size + row] = value;
-                }
-
-                mna_vector[col] = el->value;
-                break;
-            }
-            case 'c': {
-                if (_transient_method == T_NONE)
-                    break;
-
-                assert(_node == el->c->vplus._node || _node == el->c->vminus._node);
-                unsigned long this_node  = row;
-                unsigned long other_node = (_node != el->c->vplus._node) ? el->c->vplus.nuid : el->c->vminus.nuid;
-                dfloat_t value = el->value;
-
-                if (use_sparse) {
-                    //diagonal entry
-                    cs_entry(cs_transient_matrix,this_node,this_node,value);
-                    //off diagonal entry
-                    if (other_node--)
-                        cs_entry(cs_transient_matrix,this_node,other_node,-value);
-                }
-                else {
-                    //diagonal entry
-                    transient_matrix[this_node*mna_dim_size + this_node] += value;
-                    //off diagonal entry
-                    if (other_node--)
-                        transient_matrix[this_node*mna_dim_size + other_node] += -value;
-                }
-                break;
-            }
-            case 'l': {
-                assert(_node == el->l->vplus._node || _node == el->l->vminus._node);
-                dfloat_t value = (_node == el->l->vplus._node) ? +1 : -1;
-
-                unsigned long col = _n + el->idx;
+    unsigned long k;
+    struct device_table *dev = &netlist->devices;
 
-                if (use_sparse) {
-                    //group2 element, populate A2
-                    cs_entry(cs_mna_matrix,row,col,value);
-                    //group2 element, populate A2 transposed
-                    cs_entry(cs_mna_matrix,col,row,value);
-                }
-                else {
-                    //group2 element, populate A2
-                    mna_matrix[row*mna_dim_size + col] = value;
-                    //group2 element, populate A2 transposed
-                    mna_matrix[col*mna_dim_size + row] = value;
-                }
+    //populate MNA Matrix, one device type at a time
 
-                if (_transient_method == T_NONE)
-                    break;
+    const struct dense_band *band = analysis->use_band ? &analysis->band : NULL;
+    if (!use_sparse)
+        stamp_dense(mna_matrix,transient_matrix,mna_dim_size,band,_n,dev);
 
-                unsigned long row = col;
-                if (use_sparse)
-                    cs_entry(cs_transient_matrix,row,col,-el->value);
-                else
-                    transient_matrix[row*mna_dim_size + col] = -el->value;
+    for (k=0; k<dev->v.size; ++k)
+        mna_vector[_n + dev->v.idx[k]] = dev->v.value[k];
 
-                break;
-            }
-            case 'i': {
-                assert(_node == el->i->vplus._node || _node == el->i->vminus._node);
-                //we have -A1*S1, therefore we subtract from the final result
-                mna_vector[row] -=
-                    (_node == el->i->vminus._node) ? -el->value : el->value;
-                break;
-            }
-            default:  break;
-            }
-        }
+    //we have -A1*S1, therefore we subtract from the final result
+    for (k=0; k<dev->i.size; ++k) {
+        unsigned long a = dev->i.vplus[k];
+        unsigned long b = dev->i.vminus[k];
+        if (a)
+            mna_vector[a - 1] -= dev->i.value[k];
+        if (b)
+            mna_vector[b - 1] += dev->i.value[k];
     }
 
-    if (use_sparse) {
-        MSG("compress DC matrix ...")
-        cs_mna_matrix = cs_compress(cs_mna_matrix);
-        MSG("deduplicate DC entries ...")
-        if (!cs_dupl(cs_mna_matrix)) {
-            printf("cs_dupl() failed - exit.\n");
-            exit(EXIT_FAILURE);
-        }
-        if (_transient_method != T_NONE) {
-            MSG("compress transient matrix ...")
-            cs_transient_matrix = cs_compress(cs_transient_matrix);
-            MSG("deduplicate transient entries ...")
-            if (!cs_dupl(cs_transient_matrix)){
-                printf("cs_dupl() failed - exit.\n");
-                exit(EXIT_FAILURE);
-            }
-        }
-    }
+    //the offsets of the merged nodes, see topology_reduce()
+    if (analysis->topology.active)
+        for (k=0; k<mna_dim_size; ++k)
+            if (analysis->topology.rhs[k])
+                mna_vector[k] += analysis->topology.rhs[k];
 
     analysis->n = _n;
     analysis->e = e;
@@ -276,6 +555,7 @@ void analysis_init(struct netlist_info *netlist, struct analysis_info *analysis)
     analysis->mna_vector = mna_vector;
 
     analysis->decomp = decomp;
+    analysis->workspace = workspace;
 
     analysis->cs_mna_matrix = cs_mna_matrix;
     analysis->cs_transient_matrix = cs_transient_matrix;
@@ -285,54 +565,358 @@ void analysis_init(struct netlist_info *netlist, struct analysis_info *analysis)
     analyse_init_solver(analysis,_solver);
 }
 
-static unsigned long count_nonzeros(struct netlist_info *netlist) {
-    unsigned long i;
-    unsigned long j;
+void analysis_restamp(struct netlist_info *netlist, struct analysis_info *analysis) {
+    /* G and C again from the device values of netlist, after the caller
+       changed some of them (a swept resistor, a monte carlo sample). The
+       sparse pattern, cs_map and the symbolic analysis are kept, only the
+       values are scattered again, then G is factored for the solver.
+       Also puts G and C back after a fixed-step transient, which combines
+       them in place. mna_vector is left alone. */
+    unsigned long _n = analysis->n;
+    unsigned long mna_dim_size = _n + analysis->el_group2_size;
+    struct device_table *dev = &netlist->devices;
+
+    assert(_n == netlist->n - 1 && analysis->el_group2_size == netlist->el_group2_size);
+    if (analysis->use_sparse) {
+        restamp_sparse(analysis->cs_mna_matrix,&analysis->cs_map,dev,1,0);
+        if (analysis->cs_transient_matrix)
+            restamp_sparse(analysis->cs_transient_matrix,&analysis->cs_map,dev,0,1);
+    }
+    else {
+        unsigned long values = dense_values(analysis,mna_dim_size);
+        const struct dense_band *band = analysis->use_band ? &analysis->band : NULL;
+        memset(analysis->mna_matrix,0,values * sizeof(dfloat_t));
+        if (analysis->transient_matrix)
+            memset(analysis->transient_matrix,0,values * sizeof(dfloat_t));
+        stamp_dense(analysis->mna_matrix,analysis->transient_matrix,
+                    mna_dim_size,band,_n,dev);
+    }
 
+    analyse_init_solver(analysis,analysis->_solver);
+}
+
+static inline void band_stamp(struct dense_band *band, unsigned long row, unsigned long col) {
+    //widen the skyline of both rows, the stamps are symmetric
+    row = band->perm[row];
+    col = band->perm[col];
+    if (band->first[row] > col)
+        band->first[row] = col;
+    if (band->last[row] < col)
+        band->last[row] = col;
+    if (band->first[col] > row)
+        band->first[col] = row;
+    if (band->last[col] < row)
+        band->last[col] = row;
+}
+
+static unsigned long band_order(struct netlist_info *netlist, struct dense_band *band) {
+    //the band order, its skyline and bandwidth, see struct dense_band
+    struct device_table *dev = &netlist->devices;
+    struct device_array *branches[2] = { &dev->v, &dev->l };
+    struct device_array *passives[2] = { &dev->r, &dev->c };
     unsigned long _n = netlist->n - 1;
-    unsigned long nonzeros = 0;
+    unsigned long size = _n + netlist->el_group2_size;
+    unsigned long *node = (unsigned long*)malloc((netlist->el_group2_size + 1) * sizeof(unsigned long));
+    unsigned long *start = (unsigned long*)calloc(_n + 2,sizeof(unsigned long));
+    band->perm = (unsigned long*)malloc((size + 1) * sizeof(unsigned long));
+    band->first = (unsigned long*)malloc((size + 1) * sizeof(unsigned long));
+    band->last = (unsigned long*)malloc((size + 1) * sizeof(unsigned long));
+    if (!node || !start || !band->perm || !band->first || !band->last) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    unsigned long i;
+    unsigned long k;
+    int d;
+
+    //the last node of every branch, 0 if it has none
+    for (i=0; i<netlist->el_group2_size; ++i)
+        node[i] = 0;
+    for (d=0; d<2; ++d)
+        for (k=0; k<branches[d]->size; ++k) {
+            unsigned long a = branches[d]->vplus[k];
+            unsigned long b = branches[d]->vminus[k];
+            node[branches[d]->idx[k]] = a > b ? a : b;
+        }
 
-    //ignore ground node
-    for (i=1; i<=_n; ++i) {
-        struct node *_node = &netlist->node_pool[i];
-        for (j=0; j<_node->refs; ++j) {
-            struct element *el = _node->attached_el[j]._el;
-            switch (el->type) {
-            case 'r': {
-                assert(_node == el->r->vplus._node || _node == el->r->vminus._node);
-                unsigned long other_node = (_node != el->r->vplus._node) ? el->r->vplus.nuid : el->r->vminus.nuid;
-
-                //NOTE: all rows are moved up by one (we ingore the ground node)
-                nonzeros++;        //diagonal entry
-                if (other_node--)
-                    nonzeros++;    //off diagonal entry
-                break;
-            }
-            case 'v': {
-                assert(_node == el->v->vplus._node || _node == el->v->vminus._node);
+    //node a goes after the branches of the nodes before it
+    for (i=0; i<netlist->el_group2_size; ++i)
+        start[node[i] + 1]++;
+    for (i=1; i<=_n + 1; ++i)
+        start[i] += start[i - 1];
+    for (i=1; i<=_n; ++i)
+        band->perm[i - 1] = start[i] + i - 1;
+    for (i=0; i<netlist->el_group2_size; ++i)
+        band->perm[_n + i] = start[node[i]]++ + node[i];
+    free(node);
+    free(start);
+
+    for (i=0; i<size; ++i) {
+        band->first[i] = i;
+        band->last[i] = i;
+    }
+    for (d=0; d<2; ++d)
+        for (k=0; k<passives[d]->size; ++k) {
+            unsigned long a = passives[d]->vplus[k];
+            unsigned long b = passives[d]->vminus[k];
+            if (a && b)
+                band_stamp(band,a - 1,b - 1);
+        }
+    for (d=0; d<2; ++d)
+        for (k=0; k<branches[d]->size; ++k) {
+            unsigned long a = branches[d]->vplus[k];
+            unsigned long b = branches[d]->vminus[k];
+            unsigned long col = _n + branches[d]->idx[k];
+            if (a)
+                band_stamp(band,a - 1,col);
+            if (b)
+                band_stamp(band,b - 1,col);
+        }
 
-                //group2 element, populate A2
-                nonzeros++;
+    unsigned long bandwidth = 0;
+    for (i=0; i<size; ++i)
+        if (i - band->first[i] > bandwidth)
+            bandwidth = i - band->first[i];
+    band->band = bandwidth;
+    band->width = 2 * bandwidth + 1;
+    return bandwidth;
+}
 
-                //group2 element, populate A2 transposed
-                nonzeros++;
-                break;
-            }
-            case 'l': {
-                assert(_node == el->l->vplus._node || _node == el->l->vminus._node);
+static void band_mult(struct analysis_info *analysis, dfloat_t *y, dfloat_t *A, dfloat_t *x) {
+    //y = A * x, A banded
+    struct dense_band *band = &analysis->band;
+    unsigned long size = analysis->n + analysis->el_group2_size;
+    unsigned long b = band->band;
+    dfloat_t *w = analysis_workspace(analysis,W_SOLVE);
+    unsigned long i, j;
+
+    for (i=0; i<size; ++i)
+        w[band->perm[i]] = x[i];
+    for (i=0; i<size; ++i) {
+        //row i of A, column j at row[j]
+        dfloat_t *row = A + i * band->width + b - i;
+        dfloat_t result = 0;
+        for (j=band->first[i]; j<=band->last[i]; ++j)
+            result += row[j] * w[j];
+        y[i] = result;
+    }
+    //y is in the band order, back to the unknowns through the scratch
+    memcpy(w,y,size * sizeof(dfloat_t));
+    for (i=0; i<size; ++i)
+        y[i] = w[band->perm[i]];
+}
+
+static void band_mult_transposed(struct analysis_info *analysis, dfloat_t *y, dfloat_t *A, dfloat_t *x) {
+    //y = A^T * x, A banded, as band_mult() but row i scatters into y
+    struct dense_band *band = &analysis->band;
+    unsigned long size = analysis->n + analysis->el_group2_size;
+    unsigned long b = band->band;
+    dfloat_t *w = analysis_workspace(analysis,W_SOLVE);
+    unsigned long i, j;
+
+    for (i=0; i<size; ++i)
+        w[band->perm[i]] = x[i];
+    memset(y,0,size * sizeof(dfloat_t));
+    for (i=0; i<size; ++i) {
+        dfloat_t *row = A + i * band->width + b - i;
+        for (j=band->first[i]; j<=band->last[i]; ++j)
+            y[j] += row[j] * w[i];
+    }
+    memcpy(w,y,size * sizeof(dfloat_t));
+    for (i=0; i<size; ++i)
+        y[i] = w[band->perm[i]];
+}
+
+static dfloat_t *band_decomp_copy(struct analysis_info *analysis) {
+    //G into the wider rows of decomp
+    struct dense_band *band = &analysis->band;
+    unsigned long size = analysis->n + analysis->el_group2_size;
+    unsigned long width = 3 * band->band + 1;
+    dfloat_t *D = analysis->decomp;
+    unsigned long i;
 
-                //group2 element, populate A2
-                nonzeros++;
+    for (i=0; i<size; ++i) {
+        memcpy(&D[i * width],&analysis->mna_matrix[i * band->width],
+               band->width * sizeof(dfloat_t));
+        memset(&D[i * width + band->width],0,band->band * sizeof(dfloat_t));
+    }
+    return D;
+}
 
-                //group2 element, populate A2 transposed
-                nonzeros++;
-                break;
+static void band_decomp_LU(struct analysis_info *analysis) {
+    /* Partial pivoting, as gsl_linalg_LU_decomp(). The multipliers stay
+       where the pivots left them (as LAPACK dgbtrf), u_last and l_last
+       follow the fill so that the solves skip the zeros of the band. */
+    struct dense_band *band = &analysis->band;
+    unsigned long size = analysis->n + analysis->el_group2_size;
+    unsigned long b = band->band;
+    unsigned long width = 3 * b + 1;
+    dfloat_t *D = band_decomp_copy(analysis);
+    unsigned long i, j, k;
+
+    if (!band->pivot) {
+        band->pivot = (unsigned long*)malloc(3 * size * sizeof(unsigned long));
+        if (!band->pivot) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        band->u_last = band->pivot + size;
+        band->l_last = band->pivot + 2 * size;
+    }
+    unsigned long *u_last = band->u_last;
+    memcpy(u_last,band->last,size * sizeof(unsigned long));
+
+    for (k=0; k<size; ++k) {
+        //rows k .. last may have column k
+        unsigned long last = k + b < size ? k + b : size - 1;
+        dfloat_t *row_k = D + k * width + b - k;
+
+        unsigned long p = k;
+        dfloat_t max = fabs(row_k[k]);
+        for (i=k+1; i<=last; ++i) {
+            dfloat_t a = fabs(D[i * width + b + k - i]);
+            if (a > max) {
+                max = a;
+                p = i;
+            }
+        }
+        band->pivot[k] = p;
+        if (p != k) {
+            dfloat_t *row_p = D + p * width + b - p;
+            unsigned long end = u_last[k] > u_last[p] ? u_last[k] : u_last[p];
+            for (j=k; j<=end; ++j) {
+                dfloat_t tmp = row_k[j];
+                row_k[j] = row_p[j];
+                row_p[j] = tmp;
             }
-            default:  break;
+            end = u_last[k];
+            u_last[k] = u_last[p];
+            u_last[p] = end;
+        }
+
+        band->l_last[k] = k;
+        dfloat_t pivot = row_k[k];
+        if (pivot == 0)
+            continue;  //singular, left to the solve
+        unsigned long end = u_last[k];
+        for (i=k+1; i<=last; ++i) {
+            dfloat_t *row_i = D + i * width + b - i;
+            dfloat_t l = row_i[k] / pivot;
+            row_i[k] = l;
+            if (l == 0)
+                continue;
+            for (j=k+1; j<=end; ++j)
+                row_i[j] -= l * row_k[j];
+            if (u_last[i] < end)
+                u_last[i] = end;
+            band->l_last[k] = i;
+        }
+    }
+}
+
+static void band_solve_LU(struct analysis_info *analysis) {
+    struct dense_band *band = &analysis->band;
+    unsigned long size = analysis->n + analysis->el_group2_size;
+    unsigned long b = band->band;
+    unsigned long width = 3 * b + 1;
+    dfloat_t *D = analysis->decomp;
+    dfloat_t *w = analysis_workspace(analysis,W_SOLVE);
+    unsigned long i, j, k;
+
+    assert(band->pivot);
+    for (i=0; i<size; ++i)
+        w[band->perm[i]] = analysis->mna_vector[i];
+
+    //L, with the row interchanges of every step
+    for (k=0; k<size; ++k) {
+        unsigned long p = band->pivot[k];
+        if (p != k) {
+            dfloat_t tmp = w[k];
+            w[k] = w[p];
+            w[p] = tmp;
+        }
+        dfloat_t wk = w[k];
+        if (wk == 0)
+            continue;
+        for (i=k+1; i<=band->l_last[k]; ++i)
+            w[i] -= D[i * width + b + k - i] * wk;
+    }
+
+    //U
+    for (i=size; i-- > 0; ) {
+        dfloat_t *row_i = D + i * width + b - i;
+        dfloat_t result = w[i];
+        for (j=i+1; j<=band->u_last[i]; ++j)
+            result -= row_i[j] * w[j];
+        w[i] = result / row_i[i];
+    }
+
+    for (i=0; i<size; ++i)
+        analysis->x[i] = w[band->perm[i]];
+}
+
+static void band_decomp_cholesky(struct analysis_info *analysis) {
+    //L in the lower half of the rows, row by row, the fill stays in
+    //the skyline
+    struct dense_band *band = &analysis->band;
+    unsigned long size = analysis->n + analysis->el_group2_size;
+    unsigned long b = band->band;
+    unsigned long width = 3 * b + 1;
+    dfloat_t *D = band_decomp_copy(analysis);
+    unsigned long i, j, k;
+
+    for (i=0; i<size; ++i) {
+        unsigned long first = band->first[i];
+        dfloat_t *row_i = D + i * width + b - i;
+        for (j=first; j<=i; ++j) {
+            dfloat_t *row_j = D + j * width + b - j;
+            dfloat_t sum = row_i[j];
+            for (k=(first > band->first[j] ? first : band->first[j]); k<j; ++k)
+                sum -= row_i[k] * row_j[k];
+            if (j < i)
+                row_i[j] = sum / row_j[j];
+            else if (sum > 0)
+                row_i[i] = sqrt(sum);
+            else {
+                printf("%s error: matrix is not positive definite - exit\n",__FUNCTION__);
+                exit(EXIT_FAILURE);
             }
         }
     }
-    return nonzeros;
+}
+
+static void band_solve_cholesky(struct analysis_info *analysis) {
+    struct dense_band *band = &analysis->band;
+    unsigned long size = analysis->n + analysis->el_group2_size;
+    unsigned long b = band->band;
+    unsigned long width = 3 * b + 1;
+    dfloat_t *D = analysis->decomp;
+    dfloat_t *w = analysis_workspace(analysis,W_SOLVE);
+    unsigned long i, k;
+
+    for (i=0; i<size; ++i)
+        w[band->perm[i]] = analysis->mna_vector[i];
+
+    //L
+    for (i=0; i<size; ++i) {
+        dfloat_t *row_i = D + i * width + b - i;
+        dfloat_t result = w[i];
+        for (k=band->first[i]; k<i; ++k)
+            result -= row_i[k] * w[k];
+        w[i] = result / row_i[i];
+    }
+
+    //L', by the rows of L
+    for (i=size; i-- > 0; ) {
+        dfloat_t *row_i = D + i * width + b - i;
+        w[i] /= row_i[i];
+        dfloat_t wi = w[i];
+        for (k=band->first[i]; k<i; ++k)
+            w[k] -= row_i[k] * wi;
+    }
+
+    for (i=0; i<size; ++i)
+        analysis->x[i] = w[band->perm[i]];
 }
 
 void decomp_LU(struct analysis_info *analysis) {
@@ -340,6 +924,11 @@ void decomp_LU(struct analysis_info *analysis) {
     unsigned long mna_dim_size =
         analysis->n + analysis->el_group2_size;
 
+    if (analysis->use_band) {
+        band_decomp_LU(analysis);
+        return;
+    }
+
     memcpy(analysis->decomp,analysis->mna_matrix,
            mna_dim_size*mna_dim_size*sizeof(dfloat_t));
 
@@ -349,7 +938,8 @@ void decomp_LU(struct analysis_info *analysis) {
                               mna_dim_size,
                               mna_dim_size);
 
-    analysis->LU_perm = gsl_permutation_alloc(mna_dim_size);
+    if (!analysis->LU_perm)
+        analysis->LU_perm = gsl_permutation_alloc(mna_dim_size);
 
     int perm_sign;
     gsl_linalg_LU_decomp(&Aview.matrix,analysis->LU_perm,&perm_sign);
@@ -360,6 +950,11 @@ void solve_LU(struct analysis_info *analysis) {
     unsigned long mna_dim_size =
         analysis->n + analysis->el_group2_size;
 
+    if (analysis->use_band) {
+        band_solve_LU(analysis);
+        return;
+    }
+
     //GSL magic
     gsl_matrix_view Aview =
         gsl_matrix_view_array(analysis->decomp,
@@ -383,6 +978,11 @@ void decomp_cholesky(struct analysis_info *analysis) {
     unsigned long mna_dim_size =
         analysis->n + analysis->el_group2_size;
 
+    if (analysis->use_band) {
+        band_decomp_cholesky(analysis);
+        return;
+    }
+
     memcpy(analysis->decomp,analysis->mna_matrix,
            mna_dim_size*mna_dim_size*sizeof(dfloat_t));
 
@@ -392,51 +992,335 @@ void decomp_cholesky(struct analysis_info *analysis) {
                               mna_dim_size,
                               mna_dim_size);
 
-    gsl_linalg_cholesky_decomp(&Aview.matrix);
+    gsl_linalg_cholesky_decomp(&Aview.matrix);
+}
+
+void solve_cholesky(struct analysis_info *analysis) {
+    DEBUG_MSG("")
+    unsigned long mna_dim_size =
+        analysis->n + analysis->el_group2_size;
+
+    if (analysis->use_band) {
+        band_solve_cholesky(analysis);
+        return;
+    }
+
+    //GSL magic
+    gsl_matrix_view Aview =
+        gsl_matrix_view_array(analysis->decomp,
+                              mna_dim_size,
+                              mna_dim_size);
+
+    gsl_vector_view bview =
+        gsl_vector_view_array(analysis->mna_vector,
+                              mna_dim_size);
+
+    gsl_vector_view x =
+        gsl_vector_view_array(analysis->x,
+                              mna_dim_size);
+
+    gsl_linalg_cholesky_solve(&Aview.matrix,&bview.vector,&x.vector);
+}
+
+static unsigned long cs_pattern_key(const cs *A) {
+    //FNV-1a over the dimensions and the column/row indices, values ignored
+    const unsigned long prime = 1099511628211UL;
+    unsigned long key = 14695981039346656037UL;
+    int j;
+    int nz = A->p[A->n];
+
+    key = (key ^ (unsigned long)A->n) * prime;
+    key = (key ^ (unsigned long)nz) * prime;
+    for (j=0; j<=A->n; ++j)
+        key = (key ^ (unsigned long)A->p[j]) * prime;
+    for (j=0; j<nz; ++j)
+        key = (key ^ (unsigned long)A->i[j]) * prime;
+    return key;
+}
+
+static void sparse_blocks_free(struct analysis_info *analysis) {
+    int b;
+    for (b=0; b<analysis->cs_blocks_size; ++b) {
+        struct cs_block *block = &analysis->cs_blocks[b];
+        free(block->unknowns);
+        cs_spfree(block->A);
+        free(block->gather);
+        cs_sfree(block->S);
+        cs_nfree(block->N);
+        free(block->w);
+    }
+    free(analysis->cs_blocks);
+    analysis->cs_blocks = NULL;
+    analysis->cs_blocks_size = 0;
+}
+
+static void sparse_blocks_init(struct analysis_info *analysis) {
+    /* The connected components of the graph of cs_mna_matrix, its pattern
+       is symmetric as G and C are. Components go to blocks in the order of
+       their first unknown, until a block has BLOCK_MIN_SIZE unknowns. The
+       unknowns of a block keep their order, one block is the whole system
+       and is left to cs_mna_S and cs_mna_N. */
+    cs *A = analysis->cs_mna_matrix;
+    int n = A->n;
+    int *comp = (int*)malloc(n * sizeof(int));
+    int *queue = (int*)malloc(n * sizeof(int));
+    int *comp_block = (int*)malloc(n * sizeof(int));
+    if ((!comp || !queue || !comp_block) && n) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    int components = 0;
+    int blocks = 0;
+    int block_size = 0;
+    int j;
+    for (j=0; j<n; ++j)
+        comp[j] = -1;
+    for (j=0; j<n; ++j) {
+        if (comp[j] != -1)
+            continue;
+        int head = 0;
+        int tail = 0;
+        comp[j] = components;
+        queue[tail++] = j;
+        while (head < tail) {
+            int col = queue[head++];
+            int p;
+            for (p=A->p[col]; p<A->p[col + 1]; ++p) {
+                int row = A->i[p];
+                if (comp[row] == -1) {
+                    comp[row] = components;
+                    queue[tail++] = row;
+                }
+            }
+        }
+        comp_block[components++] = blocks;
+        block_size += tail;
+        if (block_size >= BLOCK_MIN_SIZE) {
+            blocks++;
+            block_size = 0;
+        }
+    }
+    if (block_size)
+        blocks++;
+
+    if (components > 1) {
+        char msg[128];
+        snprintf(msg,sizeof(msg),"%d connected components in %d blocks",components,blocks);
+        MSG(msg)
+    }
+
+    if (blocks < 2) {
+        free(comp);
+        free(queue);
+        free(comp_block);
+        return;
+    }
+
+    struct cs_block *block = (struct cs_block*)calloc(blocks,sizeof(struct cs_block));
+    int *nonzeros = (int*)calloc(blocks,sizeof(int));
+    if (!block || !nonzeros) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    //queue[] is the position of every unknown in its block from here
+    int b;
+    for (j=0; j<n; ++j) {
+        b = comp_block[comp[j]];
+        comp[j] = b;
+        queue[j] = block[b].size++;
+        nonzeros[b] += A->p[j + 1] - A->p[j];
+    }
+
+    for (b=0; b<blocks; ++b) {
+        block[b].unknowns = (int*)malloc(block[b].size * sizeof(int));
+        block[b].A = cs_spalloc(block[b].size,block[b].size,nonzeros[b],1,0);
+        block[b].gather = (int*)malloc(nonzeros[b] * sizeof(int));
+        block[b].w = (dfloat_t*)malloc(2 * block[b].size * sizeof(dfloat_t));
+        if (!block[b].unknowns || !block[b].A || (!block[b].gather && nonzeros[b]) ||
+            !block[b].w) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        block[b].A->p[0] = 0;
+    }
+
+    //the columns of a block in order, their rows stay sorted
+    for (j=0; j<n; ++j) {
+        struct cs_block *B = &block[comp[j]];
+        int col = queue[j];
+        int q = B->A->p[col];
+        int p;
+        B->unknowns[col] = j;
+        for (p=A->p[j]; p<A->p[j + 1]; ++p) {
+            B->A->i[q] = queue[A->i[p]];
+            B->gather[q] = p;
+            q++;
+        }
+        B->A->p[col + 1] = q;
+    }
+
+    analysis->cs_blocks = block;
+    analysis->cs_blocks_size = blocks;
+
+    free(nonzeros);
+    free(comp);
+    free(queue);
+    free(comp_block);
+}
+
+static void sparse_blocks_symbolic(struct analysis_info *analysis) {
+    int failed = 0;
+    int b;
+#pragma omp parallel for schedule(dynamic) reduction(||:failed)
+    for (b=0; b<analysis->cs_blocks_size; ++b) {
+        struct cs_block *block = &analysis->cs_blocks[b];
+        block->S = cs_sqr(2,block->A,0);
+        failed = failed || !block->S;
+    }
+    if (failed) {
+        printf("cs_sqr() failed - exit.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void sparse_blocks_factor(struct analysis_info *analysis) {
+    //numeric part of every block, the values come from cs_mna_matrix
+    const dfloat_t *x = analysis->cs_mna_matrix->x;
+    int failed = 0;
+    int b;
+#pragma omp parallel for schedule(dynamic) reduction(||:failed)
+    for (b=0; b<analysis->cs_blocks_size; ++b) {
+        struct cs_block *block = &analysis->cs_blocks[b];
+        int nonzeros = block->A->p[block->size];
+        int k;
+        for (k=0; k<nonzeros; ++k)
+            block->A->x[k] = x[block->gather[k]];
+        cs_nfree(block->N);
+        block->N = cs_lu(block->A,block->S,LU_SPARSE_TOL);
+        failed = failed || !block->N;
+    }
+    if (failed) {
+        printf("cs_lu() failed - exit.\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
-void solve_cholesky(struct analysis_info *analysis) {
-    DEBUG_MSG("")
-    unsigned long mna_dim_size =
-        analysis->n + analysis->el_group2_size;
+static void sparse_blocks_solve(struct analysis_info *analysis) {
+    const dfloat_t *rhs = analysis->mna_vector;
+    dfloat_t *x = analysis->x;
+    int b;
+#pragma omp parallel for schedule(dynamic)
+    for (b=0; b<analysis->cs_blocks_size; ++b) {
+        struct cs_block *block = &analysis->cs_blocks[b];
+        css *S = block->S;
+        csn *N = block->N;
+        int size = block->size;
+        dfloat_t *y = block->w;
+        dfloat_t *w = &block->w[size];
+        int k;
+
+        for (k=0; k<size; ++k)
+            y[k] = rhs[block->unknowns[k]];
+        cs_ipvec(N->pinv,y,w,size);  //w = b(p)
+        cs_lsolve(N->L,w);            //w = L\w
+        cs_usolve(N->U,w);            //w = U\w
+        cs_ipvec(S->q,w,y,size);     //x(q) = w
+        for (k=0; k<size; ++k)
+            x[block->unknowns[k]] = y[k];
+    }
+}
 
-    //GSL magic
-    gsl_matrix_view Aview =
-        gsl_matrix_view_array(analysis->decomp,
-                              mna_dim_size,
-                              mna_dim_size);
+static int cs_pattern_equal(const cs *A, const cs *B) {
+    //same dimensions and column/row indices, values ignored
+    int nz = A->p[A->n];
+    if (A->n != B->n || A->m != B->m || nz != B->p[B->n])
+        return 0;
+    if (A->p != B->p && memcmp(A->p,B->p,(A->n + 1) * sizeof(int)))
+        return 0;
+    if (A->i != B->i && memcmp(A->i,B->i,nz * sizeof(int)))
+        return 0;
+    return 1;
+}
 
-    gsl_vector_view bview =
-        gsl_vector_view_array(analysis->mna_vector,
-                              mna_dim_size);
+static int sparse_symbolic_lookup(struct analysis_info *analysis, int order) {
+    //returns 1 if the cached symbolic analysis fits the current matrix,
+    //else drops it, the caller has to redo the ordering
 
-    gsl_vector_view x =
-        gsl_vector_view_array(analysis->x,
-                              mna_dim_size);
+    cs *A = analysis->cs_mna_matrix;
+    unsigned long key = cs_pattern_key(A);
+    if ((analysis->cs_mna_S || analysis->cs_blocks || analysis->cs_mna_L) &&
+        analysis->cs_mna_S_order == order &&
+        analysis->cs_mna_S_key == key &&
+        cs_pattern_equal(A,analysis->cs_mna_S_pattern))
+        return 1;
 
-    gsl_linalg_cholesky_solve(&Aview.matrix,&bview.vector,&x.vector);
+    analysis->cs_mna_S = cs_sfree(analysis->cs_mna_S);
+    analysis->cs_mna_N = cs_nfree(analysis->cs_mna_N);
+    sparse_blocks_free(analysis);
+    analysis->cs_mna_L = supernodal_free(analysis->cs_mna_L);
+    analysis->cs_mna_S_order = order;
+    analysis->cs_mna_S_key = key;
+
+    //keep a copy of the pattern, the key only rules out most mismatches
+    int nz = A->p[A->n];
+    cs_spfree(analysis->cs_mna_S_pattern);
+    analysis->cs_mna_S_pattern = cs_spalloc(A->m,A->n,nz,0,0);
+    if (!analysis->cs_mna_S_pattern) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(analysis->cs_mna_S_pattern->p,A->p,(A->n + 1) * sizeof(int));
+    memcpy(analysis->cs_mna_S_pattern->i,A->i,nz * sizeof(int));
+    return 0;
 }
 
-void decomp_LU_sparse(struct analysis_info *analysis) {
+void refactor_LU_sparse(struct analysis_info *analysis) {
     DEBUG_MSG("")
 
-    //sparse magic
-    css *S = cs_sqr(2,analysis->cs_mna_matrix,0);
-    if (!S) {
-        printf("cs_sqr() failed - exit.\n");
-        exit(EXIT_FAILURE);
+    //numeric part only, same sparsity pattern as in decomp_LU_sparse()
+    if (analysis->cs_blocks) {
+        sparse_blocks_factor(analysis);
+        return;
     }
 
-    csn *N = cs_lu(analysis->cs_mna_matrix,S,1);
+    assert(analysis->cs_mna_S);
+    cs_nfree(analysis->cs_mna_N);
+
+    csn *N = cs_lu(analysis->cs_mna_matrix,analysis->cs_mna_S,LU_SPARSE_TOL);
     if (!N) {
         printf("cs_lu() failed - exit.\n");
         exit(EXIT_FAILURE);
     }
 
+    analysis->cs_mna_N = N;
+}
+
+void decomp_LU_sparse(struct analysis_info *analysis) {
+    DEBUG_MSG("")
+
     assert(analysis->n + analysis->el_group2_size == analysis->cs_mna_matrix->n);
 
-    analysis->cs_mna_S = S;
-    analysis->cs_mna_N = N;
+    //sparse magic
+    if (!sparse_symbolic_lookup(analysis,2)) {
+        sparse_blocks_init(analysis);
+        if (analysis->cs_blocks)
+            sparse_blocks_symbolic(analysis);
+        else {
+            css *S = cs_sqr(2,analysis->cs_mna_matrix,0);
+            if (!S) {
+                printf("cs_sqr() failed - exit.\n");
+                exit(EXIT_FAILURE);
+            }
+            analysis->cs_mna_S = S;
+        }
+    }
+    else {
+        DEBUG_MSG("reuse symbolic analysis")
+    }
+
+    refactor_LU_sparse(analysis);
     //cs_free(analysis->cs_mna_matrix);
     //analysis->cs_mna_matrix = NULL;
 }
@@ -446,17 +1330,33 @@ void solve_LU_sparse(struct analysis_info *analysis) {
     unsigned long mna_dim_size =
         analysis->n + analysis->el_group2_size;
 
-    //sparse magic
-    assert(analysis->cs_mna_matrix);
+    //sparse magic, reuse the factorization from decomp_LU_sparse()
+    if (analysis->cs_blocks) {
+        sparse_blocks_solve(analysis);
+        return;
+    }
 
-    cs *A = analysis->cs_mna_matrix;
-    dfloat_t *b = analysis->x;
+    css *S = analysis->cs_mna_S;
+    csn *N = analysis->cs_mna_N;
+    assert(S && N);
+
+    dfloat_t *b = analysis->mna_vector;
+    dfloat_t *x = analysis->x;
+    dfloat_t *w = analysis_workspace(analysis,W_SOLVE);
 
-    memcpy(b,analysis->mna_vector,mna_dim_size*sizeof(dfloat_t));
+    cs_ipvec(N->pinv,b,w,mna_dim_size);  //w = b(p)
+    cs_lsolve(N->L,w);                    //w = L\w
+    cs_usolve(N->U,w);                    //w = U\w
+    cs_ipvec(S->q,w,x,mna_dim_size);     //x(q) = w
+}
+
+void refactor_cholesky_sparse(struct analysis_info *analysis) {
+    DEBUG_MSG("")
 
-    const double tol = 1e-14;
-    if (!cs_lusol(2,A,b,tol)) {
-        printf("cs_lusol() failed - exit.\n");
+    //numeric part only, same sparsity pattern as in decomp_cholesky_sparse()
+    assert(analysis->cs_mna_L);
+    if (!supernodal_factor(analysis->cs_mna_L,analysis->cs_mna_matrix)) {
+        printf("supernodal_factor() failed - exit.\n");
         exit(EXIT_FAILURE);
     }
 }
@@ -464,40 +1364,35 @@ void solve_LU_sparse(struct analysis_info *analysis) {
 void decomp_cholesky_sparse(struct analysis_info *analysis) {
     DEBUG_MSG("")
 
-    //sparse magic
-    css *S = cs_schol(1,analysis->cs_mna_matrix);
-    if (!S) {
-        printf("cs_schol() failed - exit.\n");
-        exit(EXIT_FAILURE);
-    }
+    //sparse magic, the elimination forest keeps the independent blocks
+    //apart, see supernodal.h
+    if (!sparse_symbolic_lookup(analysis,1)) {
+        struct supernodal *L = supernodal_analyse(analysis->cs_mna_matrix);
+        if (!L) {
+            printf("supernodal_analyse() failed - exit.\n");
+            exit(EXIT_FAILURE);
+        }
+        analysis->cs_mna_L = L;
 
-    csn *N = cs_chol(analysis->cs_mna_matrix,S);
-    if (!N) {
-        printf("cs_chol() failed - exit.\n");
-        exit(EXIT_FAILURE);
+        char msg[128];
+        snprintf(msg,sizeof(msg),"supernodal cholesky: %d supernodes, %ld values, %d tasks",
+                 L->size,L->lnz,L->tasks);
+        MSG(msg)
+    }
+    else {
+        DEBUG_MSG("reuse symbolic analysis")
     }
 
-    analysis->cs_mna_S = S;
-    analysis->cs_mna_N = N;
-    //cs_free(analysis->cs_mna_matrix);
-    //analysis->cs_mna_matrix = NULL;
+    refactor_cholesky_sparse(analysis);
 }
 
 void solve_cholesky_sparse(struct analysis_info *analysis) {
     DEBUG_MSG("")
-    unsigned long mna_dim_size =
-        analysis->n + analysis->el_group2_size;
-
-    //sparse magic
-    cs *A = analysis->cs_mna_matrix;
-    dfloat_t *b = analysis->x;
 
-    memcpy(b,analysis->mna_vector,mna_dim_size*sizeof(dfloat_t));
-
-    if (!cs_cholsol(1,A,b)) {
-        printf("cs_cholsol() failed - exit.\n");
-        exit(EXIT_FAILURE);
-    }
+    //sparse magic, reuse the factorization from decomp_cholesky_sparse()
+    assert(analysis->cs_mna_L);
+    supernodal_solve(analysis->cs_mna_L,analysis->mna_vector,analysis->x,
+                     analysis_workspace(analysis,W_SOLVE));
 }
 
 static inline dfloat_t *init_preconditioner(dfloat_t *M, dfloat_t *z, dfloat_t *r, unsigned long mna_dim_size) {
@@ -531,6 +1426,16 @@ static inline dfloat_t *_mult(dfloat_t *q, dfloat_t *A, dfloat_t *x, unsigned lo
     return q;
 }
 
+static inline dfloat_t *dense_mult(struct analysis_info *analysis,
+                                   dfloat_t *y, dfloat_t *A, dfloat_t *x) {
+    //y = A * x, A full or banded
+    if (analysis->use_band)
+        band_mult(analysis,y,A,x);
+    else
+        _mult(y,A,x,analysis->n + analysis->el_group2_size);
+    return y;
+}
+
 static inline dfloat_t _dot_transposed(dfloat_t *x, dfloat_t *y, unsigned long size) {
     unsigned long i;
     dfloat_t result = 0;
@@ -548,10 +1453,23 @@ static inline dfloat_t *_mult_transposed(dfloat_t *q, dfloat_t *A, dfloat_t *x,
     return q;
 }
 
-static inline void init_M(dfloat_t *M, dfloat_t *A, unsigned long size) {
+static inline dfloat_t *dense_mult_transposed(struct analysis_info *analysis,
+                                              dfloat_t *y, dfloat_t *A, dfloat_t *x) {
+    //y = A^T * x, A full or banded
+    if (analysis->use_band)
+        band_mult_transposed(analysis,y,A,x);
+    else
+        _mult_transposed(y,A,x,analysis->n + analysis->el_group2_size);
+    return y;
+}
+
+static inline void init_M(struct analysis_info *analysis, dfloat_t *M, dfloat_t *A) {
+    //the diagonal of A, full or banded
+    unsigned long size = analysis->n + analysis->el_group2_size;
+    const struct dense_band *band = analysis->use_band ? &analysis->band : NULL;
     unsigned long k;
     for (k=0; k<size; ++k)
-        M[k] = A[k*size + k];
+        M[k] = *dense_entry(A,size,band,k,k);
 }
 
 void solve_cg(struct analysis_info *analysis, dfloat_t tol) {
@@ -560,36 +1478,11 @@ void solve_cg(struct analysis_info *analysis, dfloat_t tol) {
     unsigned long el_group2_size = analysis->el_group2_size;
     unsigned long mna_dim_size = _n + el_group2_size;
 
-    //dfloat_t *_r = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    dfloat_t *_r = (dfloat_t*)calloc(mna_dim_size,sizeof(dfloat_t));
-    if (!_r) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_z = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_z) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_M = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_M) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_p = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_p) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_q = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_q) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
+    dfloat_t *_r = analysis_workspace(analysis,W_ITER_R);
+    dfloat_t *_z = analysis_workspace(analysis,W_ITER_Z);
+    dfloat_t *_M = analysis_workspace(analysis,W_ITER_M);
+    dfloat_t *_p = analysis_workspace(analysis,W_ITER_P);
+    dfloat_t *_q = analysis_workspace(analysis,W_ITER_Q);
 
     dfloat_t *_A = analysis->mna_matrix;
     dfloat_t *_b = analysis->mna_vector;
@@ -600,7 +1493,7 @@ void solve_cg(struct analysis_info *analysis, dfloat_t tol) {
     //                 _r = b
     memset(_x,0,mna_dim_size*sizeof(dfloat_t));
     memcpy(_r,_b,mna_dim_size*sizeof(dfloat_t));
-    init_M(_M,_A,mna_dim_size);
+    init_M(analysis,_M,_A);
     dfloat_t rho_old = _dot(_r,_r,mna_dim_size);
     dfloat_t norm_b = sqrt(_dot(_b,_b,mna_dim_size));
     if (norm_b == 0)
@@ -618,7 +1511,7 @@ void solve_cg(struct analysis_info *analysis, dfloat_t tol) {
             _p = _dot_add(_p,_z,beta,_p,mna_dim_size);
         }
         rho_old = rho;
-        _q = _mult(_q,_A,_p,mna_dim_size);
+        _q = dense_mult(analysis,_q,_A,_p);
         dfloat_t alpha = rho/_dot(_p,_q,mna_dim_size);
         _x = _dot_add(_x,_x,alpha,_p,mna_dim_size);
         _r = _dot_add(_r,_r,-alpha,_q,mna_dim_size);
@@ -626,12 +1519,6 @@ void solve_cg(struct analysis_info *analysis, dfloat_t tol) {
         if (cond < tol)
             break;
     }
-
-    free(_r);
-    free(_z);
-    free(_M);
-    free(_p);
-    free(_q);
 }
 
 void solve_cg_sparse(struct analysis_info *analysis, dfloat_t tol) {
@@ -640,36 +1527,11 @@ void solve_cg_sparse(struct analysis_info *analysis, dfloat_t tol) {
     unsigned long el_group2_size = analysis->el_group2_size;
     unsigned long mna_dim_size = _n + el_group2_size;
 
-    //dfloat_t *_r = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    dfloat_t *_r = (dfloat_t*)calloc(mna_dim_size,sizeof(dfloat_t));
-    if (!_r) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_z = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_z) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_M = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_M) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_p = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_p) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_q = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_q) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
+    dfloat_t *_r = analysis_workspace(analysis,W_ITER_R);
+    dfloat_t *_z = analysis_workspace(analysis,W_ITER_Z);
+    dfloat_t *_M = analysis_workspace(analysis,W_ITER_M);
+    dfloat_t *_p = analysis_workspace(analysis,W_ITER_P);
+    dfloat_t *_q = analysis_workspace(analysis,W_ITER_Q);
 
     cs *_A = analysis->cs_mna_matrix;
     dfloat_t *_b = analysis->mna_vector;
@@ -712,13 +1574,6 @@ void solve_cg_sparse(struct analysis_info *analysis, dfloat_t tol) {
         if (cond < tol)
             break;
     }
-
-    free(_r);
-    free(_z);
-    free(_M);
-    free(_p);
-    free(_q);
-
 }
 void solve_bi_cg(struct analysis_info *analysis, dfloat_t tol) {
     DEBUG_MSG("")
@@ -726,60 +1581,15 @@ void solve_bi_cg(struct analysis_info *analysis, dfloat_t tol) {
     unsigned long el_group2_size = analysis->el_group2_size;
     unsigned long mna_dim_size = _n + el_group2_size;
 
-    //dfloat_t *_r = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    dfloat_t *_r = (dfloat_t*)calloc(mna_dim_size,sizeof(dfloat_t));
-    if (!_r) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    //dfloat_t *_r_ = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    dfloat_t *_r_ = (dfloat_t*)calloc(mna_dim_size,sizeof(dfloat_t));
-    if (!_r_) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_z = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_z) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_z_ = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_z_) {        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_M = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_M) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_p = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_p) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_q = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_q) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_p_ = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_p_) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_q_ = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_q_) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
+    dfloat_t *_r = analysis_workspace(analysis,W_ITER_R);
+    dfloat_t *_r_ = analysis_workspace(analysis,W_ITER_R_);
+    dfloat_t *_z = analysis_workspace(analysis,W_ITER_Z);
+    dfloat_t *_z_ = analysis_workspace(analysis,W_ITER_Z_);
+    dfloat_t *_M = analysis_workspace(analysis,W_ITER_M);
+    dfloat_t *_p = analysis_workspace(analysis,W_ITER_P);
+    dfloat_t *_q = analysis_workspace(analysis,W_ITER_Q);
+    dfloat_t *_p_ = analysis_workspace(analysis,W_ITER_P_);
+    dfloat_t *_q_ = analysis_workspace(analysis,W_ITER_Q_);
 
     dfloat_t *_A = analysis->mna_matrix;
     dfloat_t *_b = analysis->mna_vector;
@@ -790,7 +1600,7 @@ void solve_bi_cg(struct analysis_info *analysis, dfloat_t tol) {
     memset(_x,0,mna_dim_size*sizeof(dfloat_t));
     memcpy(_r,_b,mna_dim_size*sizeof(dfloat_t));
     memcpy(_r_,_r,mna_dim_size*sizeof(dfloat_t));
-    init_M(_M,_A,mna_dim_size);
+    init_M(analysis,_M,_A);
     dfloat_t rho_old = _dot(_r,_r,mna_dim_size);
     dfloat_t norm_b = sqrt(_dot(_b,_b,mna_dim_size));
     if (norm_b == 0)
@@ -823,8 +1633,8 @@ void solve_bi_cg(struct analysis_info *analysis, dfloat_t tol) {
             _p_ = _dot_add(_p_,_z_,beta,_p_,mna_dim_size);
         }
         rho_old = rho;
-        _q = _mult(_q,_A,_p,mna_dim_size);
-        _q_ = _mult_transposed(_q_,_A,_p_,mna_dim_size);
+        _q = dense_mult(analysis,_q,_A,_p);
+        _q_ = dense_mult_transposed(analysis,_q_,_A,_p_);
         dfloat_t omega = _dot(_p_,_q,mna_dim_size);
 #ifdef PRECISION_DOUBLE
         dfloat_t abs_omega = fabs(rho);
@@ -843,16 +1653,6 @@ void solve_bi_cg(struct analysis_info *analysis, dfloat_t tol) {
         if (cond < tol)
             break;
     }
-
-    free(_r);
-    free(_z);
-    free(_M);
-    free(_p);
-    free(_q);
-    free(_r_);
-    free(_z_);
-    free(_p_);
-    free(_q_);
 }
 
 void solve_bi_cg_sparse(struct analysis_info *analysis, dfloat_t tol) {
@@ -861,60 +1661,15 @@ void solve_bi_cg_sparse(struct analysis_info *analysis, dfloat_t tol) {
     unsigned long el_group2_size = analysis->el_group2_size;
     unsigned long mna_dim_size = _n + el_group2_size;
 
-    //dfloat_t *_r = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    dfloat_t *_r = (dfloat_t*)calloc(mna_dim_size,sizeof(dfloat_t));
-    if (!_r) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    //dfloat_t *_r_ = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    dfloat_t *_r_ = (dfloat_t*)calloc(mna_dim_size,sizeof(dfloat_t));
-    if (!_r_) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_z = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_z) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_z_ = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_z_) {        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_M = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_M) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_p = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_p) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_q = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_q) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_p_ = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_p_) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-
-    dfloat_t *_q_ = (dfloat_t*)malloc(mna_dim_size*sizeof(dfloat_t));
-    if (!_q_) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
+    dfloat_t *_r = analysis_workspace(analysis,W_ITER_R);
+    dfloat_t *_r_ = analysis_workspace(analysis,W_ITER_R_);
+    dfloat_t *_z = analysis_workspace(analysis,W_ITER_Z);
+    dfloat_t *_z_ = analysis_workspace(analysis,W_ITER_Z_);
+    dfloat_t *_M = analysis_workspace(analysis,W_ITER_M);
+    dfloat_t *_p = analysis_workspace(analysis,W_ITER_P);
+    dfloat_t *_q = analysis_workspace(analysis,W_ITER_Q);
+    dfloat_t *_p_ = analysis_workspace(analysis,W_ITER_P_);
+    dfloat_t *_q_ = analysis_workspace(analysis,W_ITER_Q_);
 
     cs *_A = analysis->cs_mna_matrix;
     dfloat_t *_b = analysis->mna_vector;
@@ -989,38 +1744,44 @@ void solve_bi_cg_sparse(struct analysis_info *analysis, dfloat_t tol) {
         if (cond < tol)
             break;
     }
-
-    free(_r);
-    free(_z);
-    free(_M);
-    free(_p);
-    free(_q);
-    free(_r_);
-    free(_z_);
-    free(_p_);
-    free(_q_);
 }
 
-static void write_result(FILE *f,
-                         struct cmd_print_plot_item *item,
-                         struct analysis_info *analysis,
-                         const dfloat_t abs_time) {
-    dfloat_t value = 0;
-    char *name = NULL;
-
+static dfloat_t probe_value(struct cmd_print_plot_item *item,
+                            struct analysis_info *analysis) {
     assert(item->type == 'v' || item->type == 'i');
+    struct topology *t = &analysis->topology;
     if (item->type == 'v') {
-        name = item->cnode._node->name;
-        unsigned long idx = item->cnode._node->nuid;
+        unsigned long nuid = item->cnode._node->nuid;
+        unsigned long idx = topology_node(t,nuid);
         //ground node is always 0
-        if (idx)
-            value = analysis->x[idx - 1];
+        dfloat_t value = idx ? analysis->x[idx - 1] : 0;
+        if (t->active && t->node_offset[nuid])
+            value += t->node_offset[nuid];
+        return value;
     }
     else {
-        name = item->cel._el->name;
-        unsigned long idx = analysis->n + item->cel._el->idx;
-        value = analysis->x[idx];
+        unsigned long idx = topology_branch(t,item->cel._el->idx);
+        //removed source, see write_results()
+        if (idx == ULONG_MAX)
+            return t->x[t->n + item->cel._el->idx];
+        return analysis->x[analysis->n + idx];
     }
+}
+
+static char *probe_name(struct cmd_print_plot_item *item) {
+    assert(item->type == 'v' || item->type == 'i');
+    if (item->type == 'v')
+        return item->cnode._node->name;
+    else
+        return item->cel._el->name;
+}
+
+static void write_result(FILE *f,
+                         struct cmd_print_plot_item *item,
+                         struct analysis_info *analysis,
+                         const dfloat_t abs_time) {
+    dfloat_t value = probe_value(item,analysis);
+    char *name = probe_name(item);
 
     int status = fprintf(f,"%s : %5.3f : %+e\n",name,abs_time,value);
     if (status < 0) {
@@ -1029,35 +1790,55 @@ static void write_result(FILE *f,
     }
 }
 
+static void write_result_row(struct cmd_print_plot *print_plot,
+                             struct analysis_info *analysis,
+                             const dfloat_t abs_time) {
+    //one packed row per timestep, see waveform.h
+    double *row = print_plot->row;
+    unsigned long j;
+
+    row[0] = abs_time;
+    for (j=0; j<print_plot->item_num; ++j)
+        row[j + 1] = probe_value(&print_plot->item[j],analysis);
+
+    size_t size = print_plot->item_num + 1;
+    if (fwrite(row,sizeof(double),size,print_plot->f) != size) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+}
+
 static void write_results(struct netlist_info *netlist,
                           struct analysis_info *analysis,
                           const dfloat_t abs_time) {
     DEBUG_MSG("")
     unsigned long i;
     unsigned long j;
+
+    //the currents of the removed sources
+    if (analysis->topology.probed)
+        topology_expand(netlist,&analysis->topology,analysis->x);
+
     for (i=0; i<netlist->cmd_pool_size; ++i) {
         struct command *cmd = &netlist->cmd_pool[i];
-        if (cmd->type == CMD_PRINT || cmd->type == CMD_PLOT)
-            for (j=0; j<cmd->print_plot.item_num; ++j)
-                write_result(cmd->print_plot.f,
-                             &cmd->print_plot.item[j],
-                             analysis,abs_time);
-
+        if (cmd->type != CMD_PRINT && cmd->type != CMD_PLOT)
+            continue;
+        if (cmd->print_plot.row) {
+            write_result_row(&cmd->print_plot,analysis,abs_time);
+            continue;
+        }
+        for (j=0; j<cmd->print_plot.item_num; ++j)
+            write_result(cmd->print_plot.f,
+                         &cmd->print_plot.item[j],
+                         analysis,abs_time);
     }
 }
 
-static int get_sparse(struct command *pool, unsigned long size) {
-    if (force_sparse)
-        return 1;
-
-    unsigned long i;
-    for (i=0; i<size; ++i) {
-        struct command *cmd = &pool[size - 1 - i];
-        if (cmd->type == CMD_OPTION && cmd->option[CMD_OPT_SPARSE])
-            return 1;
-    }
-    return 0;
-}
+//these must be in the same order as in the enum solver in analysis.h
+static const char *solver_base[] = { "LU solver", "cholesky solver", "bi-cg solver",
+                                     "cg solver", "sparse LU solver",
+                                     "sparse cholesky solver", "sparse bi-cg solver",
+                                     "sparse cg solver" };
 
 static inline enum solver option_to_solver(int *option, const int use_sparse) {
     if (use_sparse) {
@@ -1121,27 +1902,155 @@ static enum transient_method get_transient_method(struct command *pool, unsigned
         return T_NONE;
 
     for (i=0; i<size; ++i) {
-        struct command *cmd = &pool[size - 1 - i];
-        if (cmd->type == CMD_OPTION) {
-            enum transient_method _transient = option_to_transient(cmd->option);
-            if (_transient != T_NONE)
-                return _transient;
-        }
+        struct command *cmd = &pool[size - 1 - i];
+        if (cmd->type == CMD_OPTION) {
+            enum transient_method _transient = option_to_transient(cmd->option);
+            if (_transient != T_NONE)
+                return _transient;
+        }
+    }
+
+    return _transient_default;
+}
+
+static dfloat_t get_option_value(struct command *pool, unsigned long size,
+                                 enum cmd_option_type type, dfloat_t default_value) {
+    //last value wins!
+
+    unsigned long i;
+    for (i=0; i<size; ++i) {
+        struct command *cmd = &pool[size - 1 - i];
+        if (cmd->type == CMD_OPTION && cmd->option[type])
+            return cmd->option_value[type];
+    }
+    return default_value;
+}
+
+static dfloat_t get_tolerance(struct command *pool, unsigned long size) {
+    return get_option_value(pool,size,CMD_OPT_ITOL,DEFAULT_TOL);
+}
+
+static int get_option_flag(struct command *pool, unsigned long size,
+                           enum cmd_option_type type) {
+    unsigned long i;
+    for (i=0; i<size; ++i) {
+        struct command *cmd = &pool[i];
+        if (cmd->type == CMD_OPTION && cmd->option[type])
+            return 1;
     }
+    return 0;
+}
 
-    return _transient_default;
+static unsigned long default_memory_budget() {
+    //half of the physical memory
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page_size <= 0)
+        return DEFAULT_MEMBUDGET;
+    return (unsigned long)pages / 2 * page_size;
 }
 
-static dfloat_t get_tolerance(struct command *pool, unsigned long size) {
-    //last tolerance wins!
+static int get_storage_option(struct command *pool, unsigned long size) {
+    //last storage wins! -1 for none
+    if (force_sparse)
+        return 1;
 
     unsigned long i;
     for (i=0; i<size; ++i) {
         struct command *cmd = &pool[size - 1 - i];
-        if (cmd->type == CMD_OPTION && cmd->option[CMD_OPT_ITOL])
-            return cmd->value;
+        if (cmd->type != CMD_OPTION)
+            continue;
+        if (cmd->option[CMD_OPT_SPARSE])
+            return 1;
+        if (cmd->option[CMD_OPT_DENSE])
+            return 0;
+    }
+    return -1;
+}
+
+static int get_sparse(struct netlist_info *netlist, struct analysis_info *analysis) {
+    /* Dense storage costs mna_matrix and decomp, plus transient_matrix for
+       a transient and a copy of G for the adaptive one. Sparse storage
+       costs the pattern once and the values of each matrix, the fill of
+       the factorization is not known before the symbolic analysis. Banded
+       storage is dense storage of the rows of the band only, see struct
+       dense_band, for the direct solvers. */
+    struct command *pool = netlist->cmd_pool;
+    unsigned long pool_size = netlist->cmd_pool_size;
+    struct device_table *dev = &netlist->devices;
+
+    unsigned long size = netlist->n - 1 + netlist->el_group2_size;
+    //four stamps per device, one more for the -L of l, duplicates included
+    unsigned long nonzeros = 4 * (dev->r.size + dev->c.size + dev->v.size + dev->l.size)
+        + dev->l.size;
+    if (nonzeros > size * size)
+        nonzeros = size * size;
+
+    unsigned long matrices = 2;
+    if (analysis->_transient_method != T_NONE)
+        matrices += analysis->adaptive ? 2 : 1;
+
+    unsigned long band = band_order(netlist,&analysis->band);
+    int banded = 3 * band + 1 <= BAND_MAX_FILL * size;
+
+    unsigned long dense_bytes = matrices * size * size * sizeof(dfloat_t);
+    unsigned long band_bytes = ((matrices - 1) * (2 * band + 1) + 3 * band + 1)
+        * size * sizeof(dfloat_t);
+    unsigned long sparse_bytes = (size + 1 + nonzeros) * sizeof(int)
+        + (matrices - 1) * nonzeros * sizeof(dfloat_t);
+    unsigned long budget =
+        get_option_value(pool,pool_size,CMD_OPT_MEMBUDGET,default_memory_budget());
+    if (banded)
+        dense_bytes = band_bytes;
+
+    char msg[256];
+    snprintf(msg,sizeof(msg),"n = %lu, nnz <= %lu, bandwidth %lu, dense %lu bytes, sparse %lu bytes, budget %lu bytes",
+             size,nonzeros,band,dense_bytes,sparse_bytes,budget);
+    MSG(msg)
+
+    int use_sparse = get_storage_option(pool,pool_size);
+    const char *reason = "requested";
+    if (use_sparse == 0 && dense_bytes > budget)
+        printf("***  WARNING  ***    dense matrices need %lu bytes, over the memory budget (%lu bytes)\n",
+               dense_bytes,budget);
+    else if (use_sparse == -1) {
+        if (dense_bytes > budget) {
+            use_sparse = 1;
+            reason = "dense matrices exceed the memory budget";
+        }
+        else if (size <= DENSE_MAX_SIZE) {
+            use_sparse = 0;
+            reason = "small matrix";
+        }
+        else if (banded && band <= BAND_MAX_SIZE) {
+            use_sparse = 0;
+            reason = "narrow band";
+        }
+        else if (nonzeros >= DENSE_MIN_FILL * size * size) {
+            use_sparse = 0;
+            reason = "dense matrix";
+        }
+        else {
+            use_sparse = 1;
+            reason = "sparse matrix";
+        }
+    }
+    if (use_sparse && sparse_bytes > budget)
+        printf("***  WARNING  ***    sparse matrices need %lu bytes, over the memory budget (%lu bytes)\n",
+               sparse_bytes,budget);
+
+    analysis->use_band = !use_sparse && banded;
+    if (!analysis->use_band) {
+        free(analysis->band.perm);
+        free(analysis->band.first);
+        free(analysis->band.last);
+        memset(&analysis->band,0,sizeof(struct dense_band));
     }
-    return DEFAULT_TOL;
+
+    snprintf(msg,sizeof(msg),"%s storage (%s)",
+             use_sparse ? "sparse" : analysis->use_band ? "banded" : "dense",reason);
+    MSG(msg)
+    return use_sparse;
 }
 
 static void analyse_init_solver(struct analysis_info *analysis,
@@ -1185,22 +2094,29 @@ static void analyse_dc_init(struct cmd_dc *dc,
                             enum solver _solver, dfloat_t tol) {
     DEBUG_MSG("")
     unsigned long _n = analysis->n;
+    struct topology *t = &analysis->topology;
 
     //init mna_vector
     struct element *el = dc->source._el;
     switch (el->type) {
     case 'v': {
-        analysis->mna_vector[_n + el->idx] = dc->begin;
+        //the swept source is never removed, see topology_reduce()
+        unsigned long row = _n + topology_branch(t,el->idx);
+        analysis->mna_vector[row] = dc->begin;
+        if (t->active && t->rhs[row])
+            analysis->mna_vector[row] += t->rhs[row];
         break;
     }
     case 'i': {
         //we have -A1*S1, therefore we subtract from the final result
-        if (el->i->vplus._node->nuid) {
-            unsigned long idx = el->i->vplus._node->nuid - 1;
+        unsigned long vplus = topology_node(t,el->i->vplus._node->nuid);
+        unsigned long vminus = topology_node(t,el->i->vminus._node->nuid);
+        if (vplus) {
+            unsigned long idx = vplus - 1;
             analysis->mna_vector[idx] -= dc->begin - el->value;
         }
-        if (el->i->vminus._node->nuid) {
-            unsigned long idx = el->i->vminus._node->nuid - 1;
+        if (vminus) {
+            unsigned long idx = vminus - 1;
             analysis->mna_vector[idx] += dc->begin - el->value;
         }
         break;
@@ -1215,21 +2131,24 @@ static void analyse_dc_update(struct cmd_dc *dc,
                               enum solver _solver, dfloat_t tol) {
     DEBUG_MSG("")
     unsigned long _n = analysis->n;
+    struct topology *t = &analysis->topology;
     struct element *el = dc->source._el;
     switch (el->type) {
     case 'v': {
         //update mna_vector
-        analysis->mna_vector[_n + el->idx] += dc->step;
+        analysis->mna_vector[_n + topology_branch(t,el->idx)] += dc->step;
         break;
     }
     case 'i': {
         //we have -A1*S1, therefore we subtract from the final result
-        if (el->i->vplus._node->nuid) {
-            unsigned long idx = el->i->vplus._node->nuid - 1;
+        unsigned long vplus = topology_node(t,el->i->vplus._node->nuid);
+        unsigned long vminus = topology_node(t,el->i->vminus._node->nuid);
+        if (vplus) {
+            unsigned long idx = vplus - 1;
             analysis->mna_vector[idx] -= dc->step;
         }
-        if (el->i->vminus._node->nuid) {
-            unsigned long idx = el->i->vminus._node->nuid - 1;
+        if (vminus) {
+            unsigned long idx = vminus - 1;
             analysis->mna_vector[idx] += dc->step;
         }
         break;
@@ -1256,18 +2175,61 @@ static void analyse_dc(struct cmd_dc *dc,
     }
 }
 
-static void open_logfiles(struct netlist_info *netlist) {
+static void write_waveform_header(struct cmd_print_plot *print_plot) {
+    //see waveform.h
+    FILE *f = print_plot->f;
+    uint32_t header[3] = { WAVEFORM_VERSION, WAVEFORM_BOM, print_plot->item_num };
+    int status = 1;
+    unsigned int j;
+
+    status &= fwrite(WAVEFORM_MAGIC,1,WAVEFORM_MAGIC_SIZE,f) == WAVEFORM_MAGIC_SIZE;
+    status &= fwrite(header,sizeof(uint32_t),3,f) == 3;
+    for (j=0; j<print_plot->item_num; ++j) {
+        char *name = probe_name(&print_plot->item[j]);
+        uint32_t length = strlen(name);
+        status &= fwrite(&length,sizeof(uint32_t),1,f) == 1;
+        status &= fwrite(name,1,length,f) == length;
+    }
+    if (!status) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void open_logfiles(struct netlist_info *netlist, const int binary) {
     DEBUG_MSG("")
     unsigned long i;
     for (i=0; i<netlist->cmd_pool_size; ++i) {
         struct command *cmd = &netlist->cmd_pool[i];
         if (cmd->type == CMD_PRINT || cmd->type == CMD_PLOT) {
-            FILE *f = fopen(cmd->print_plot.logfile,"w");
+            struct cmd_print_plot *print_plot = &cmd->print_plot;
+            if (binary) {
+                //plot_XXXXX.log -> plot_XXXXX.bin
+                char *ext = strrchr(print_plot->logfile,'.');
+                assert(ext && strlen(ext) == 4);
+                strcpy(ext,".bin");
+            }
+
+            FILE *f = fopen(print_plot->logfile,binary ? "wb" : "w");
             if (!f) {
                 perror(__FUNCTION__);
                 exit(EXIT_FAILURE);
             }
-            cmd->print_plot.f = f;
+            if (setvbuf(f,NULL,_IOFBF,WAVEFORM_BUFFER_SIZE)) {
+                perror(__FUNCTION__);
+                exit(EXIT_FAILURE);
+            }
+            print_plot->f = f;
+
+            if (binary) {
+                print_plot->row =
+                    (double *)malloc((print_plot->item_num + 1) * sizeof(double));
+                if (!print_plot->row) {
+                    perror(__FUNCTION__);
+                    exit(EXIT_FAILURE);
+                }
+                write_waveform_header(print_plot);
+            }
         }
     }
 }
@@ -1290,6 +2252,8 @@ static void close_logfiles(struct netlist_info *netlist) {
                 perror(__FUNCTION__);
                 exit(EXIT_FAILURE);
             }
+            free(cmd->print_plot.row);
+            cmd->print_plot.row = NULL;
         }
     }
 }
@@ -1304,6 +2268,9 @@ static void analyse_log(struct analysis_info *analysis) {
     unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
     if (use_sparse)
         cs_print(analysis->cs_mna_matrix,"mna_sparse_matrix.log",0);
+    else if (analysis->use_band)
+        fprint_dfloat_array("mna_band_matrix.log",
+                            mna_dim_size,analysis->band.width,analysis->mna_matrix);
     else
         fprint_dfloat_array("mna_dense_matrix.log",
                             mna_dim_size,mna_dim_size,analysis->mna_matrix);
@@ -1331,50 +2298,77 @@ static struct command *get_tran(struct command *pool, unsigned long size) {
     return NULL;
 }
 
-static void analyse_transient_update(struct netlist_info *netlist,
-                                     struct analysis_info *analysis,
-                                     const dfloat_t abs_time) {
-    DEBUG_MSG("")
+static void source_table_add(struct source_table *table, struct _transient_ *tran,
+                             unsigned long *next, const unsigned long row,
+                             const dfloat_t sign, const dfloat_t shift) {
+    //count with table->scatter == NULL, fill otherwise
+    unsigned long slot = 0;
+    switch (tran->type) {
+    case TR_EXP:
+        slot = next[TR_EXP];
+        if (table->scatter)
+            table->exp[slot] = tran->data.exp;
+        break;
+    case TR_SIN:
+        slot = table->exp_size + next[TR_SIN];
+        if (table->scatter)
+            table->sin[next[TR_SIN]] = tran->data.sin;
+        break;
+    case TR_PULSE:
+        slot = table->exp_size + table->sin_size + next[TR_PULSE];
+        if (table->scatter)
+            table->pulse[next[TR_PULSE]] = tran->data.pulse;
+        break;
+    case TR_PWL:
+        slot = table->exp_size + table->sin_size + table->pulse_size + next[TR_PWL];
+        if (table->scatter)
+            table->pwl[next[TR_PWL]] = tran->data.pwl;
+        break;
+    }
+    next[tran->type]++;
+
+    //current sources hit two rows but are evaluated once
+    if (row != ULONG_MAX) {
+        if (table->scatter) {
+            table->scatter[table->scatter_size].row = row;
+            table->scatter[table->scatter_size].slot = slot;
+            table->scatter[table->scatter_size].sign = sign;
+            table->scatter[table->scatter_size].shift = shift;
+        }
+        table->scatter_size++;
+    }
+}
+
+static inline dfloat_t source_shift(struct topology *t, unsigned long row) {
+    return t->active ? t->rhs[row] : 0;
+}
+
+static void source_table_walk(struct netlist_info *netlist,
+                              struct analysis_info *analysis,
+                              unsigned long *next) {
+    struct source_table *table = &analysis->sources;
+    struct topology *t = &analysis->topology;
     unsigned long i;
+
+    //transient sources are never removed, but their rows may hold the
+    //offsets of merged nodes, see topology_reduce()
+    table->scatter_size = 0;
     for (i=0; i<netlist->el_group1_size; ++i) {
         struct element *el = &netlist->el_group1_pool[i];
         if (el->type == 'i') {
             struct _transient_ *tran = el->i->transient;
             if (!tran)
                 continue;
-            if (el->i->vplus._node->nuid) {
-                unsigned long idx = el->i->vplus._node->nuid - 1;
-                switch (tran->type) {
-                case TR_EXP:
-                    analysis->mna_vector[idx] = -tran->update.exp(&tran->data.exp,abs_time);
-                    break;
-                case TR_SIN:
-                    analysis->mna_vector[idx] = -tran->update.sin(&tran->data.sin,abs_time);
-                    break;
-                case TR_PULSE:
-                    analysis->mna_vector[idx] = -tran->update.pulse(&tran->data.pulse,abs_time);
-                    break;
-                case TR_PWL:
-                    analysis->mna_vector[idx] = -tran->update.pwl(&tran->data.pwl,abs_time);
-                    break;
-                }
-            }
-            if (el->i->vminus._node->nuid) {
-                unsigned long idx = el->i->vminus._node->nuid - 1;
-                switch (tran->type) {
-                case TR_EXP:
-                    analysis->mna_vector[idx] = tran->update.exp(&tran->data.exp,abs_time);
-                    break;
-                case TR_SIN:
-                    analysis->mna_vector[idx] = tran->update.sin(&tran->data.sin,abs_time);
-                    break;
-                case TR_PULSE:
-                    analysis->mna_vector[idx] = tran->update.pulse(&tran->data.pulse,abs_time);
-                    break;
-                case TR_PWL:
-                    analysis->mna_vector[idx] = tran->update.pwl(&tran->data.pwl,abs_time);
-                    break;
-                }
+            unsigned long vplus = topology_node(t,el->i->vplus._node->nuid);
+            unsigned long vminus = topology_node(t,el->i->vminus._node->nuid);
+            unsigned long slot = next[tran->type];
+            source_table_add(table,tran,next,vplus ? vplus - 1 : ULONG_MAX,-1,
+                             vplus ? source_shift(t,vplus - 1) : 0);
+            if (vminus) {
+                //same slot, do not count the source twice
+                next[tran->type] = slot;
+                source_table_add(table,tran,next,vminus - 1,+1,
+                                 source_shift(t,vminus - 1));
             }
         }
     }
@@ -1385,25 +2379,74 @@ static void analyse_transient_update(struct netlist_info *netlist,
             struct _transient_ *tran = el->v->transient;
             if (!tran)
                 continue;
-            unsigned long idx = analysis->n + el->idx;
-            switch (tran->type) {
-            case TR_EXP:
-                analysis->mna_vector[idx] = tran->update.exp(&tran->data.exp,abs_time);
-                break;
-            case TR_SIN:
-                analysis->mna_vector[idx] = tran->update.sin(&tran->data.sin,abs_time);
-                break;
-            case TR_PULSE:
-                analysis->mna_vector[idx] = tran->update.pulse(&tran->data.pulse,abs_time);
-                break;
-            case TR_PWL:
-                analysis->mna_vector[idx] = tran->update.pwl(&tran->data.pwl,abs_time);
-                break;
-            }
+            unsigned long row = analysis->n + topology_branch(t,el->idx);
+            source_table_add(table,tran,next,row,+1,source_shift(t,row));
         }
     }
 }
 
+static void source_table_init(struct netlist_info *netlist,
+                              struct analysis_info *analysis) {
+    //group the transient sources by type once, so every timestep
+    //evaluates contiguous homogeneous batches instead of switching
+    //on every element of the pools
+    DEBUG_MSG("")
+    struct source_table *table = &analysis->sources;
+    unsigned long next[TR_PWL + 1] = { 0, 0, 0, 0 };
+
+    memset(table,0,sizeof(struct source_table));
+    source_table_walk(netlist,analysis,next);
+
+    table->exp_size = next[TR_EXP];
+    table->sin_size = next[TR_SIN];
+    table->pulse_size = next[TR_PULSE];
+    table->pwl_size = next[TR_PWL];
+    unsigned long size =
+        table->exp_size + table->sin_size + table->pulse_size + table->pwl_size;
+
+    table->exp = (struct transient_exp *)malloc(table->exp_size * sizeof(struct transient_exp));
+    table->sin = (struct transient_sin *)malloc(table->sin_size * sizeof(struct transient_sin));
+    table->pulse = (struct transient_pulse *)malloc(table->pulse_size * sizeof(struct transient_pulse));
+    table->pwl = (struct transient_pwl *)malloc(table->pwl_size * sizeof(struct transient_pwl));
+    table->value = (dfloat_t *)malloc(size * sizeof(dfloat_t));
+    table->scatter =
+        (struct source_scatter *)malloc((table->scatter_size + 1) * sizeof(struct source_scatter));
+    if ((table->exp_size && !table->exp) || (table->sin_size && !table->sin) ||
+        (table->pulse_size && !table->pulse) || (table->pwl_size && !table->pwl) ||
+        (size && !table->value) || !table->scatter) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(next,0,sizeof(next));
+    source_table_walk(netlist,analysis,next);
+}
+
+static void analyse_transient_update(struct netlist_info *netlist,
+                                     struct analysis_info *analysis,
+                                     const dfloat_t abs_time) {
+    DEBUG_MSG("")
+    struct source_table *table = &analysis->sources;
+    dfloat_t *value = table->value;
+    unsigned long i;
+
+    analysis_transient_eval_exp(table->exp,table->exp_size,abs_time,value);
+    value += table->exp_size;
+    analysis_transient_eval_sin(table->sin,table->sin_size,abs_time,value);
+    value += table->sin_size;
+    analysis_transient_eval_pulse(table->pulse,table->pulse_size,abs_time,value);
+    value += table->pulse_size;
+    analysis_transient_eval_pwl(table->pwl,table->pwl_size,abs_time,value);
+
+    //serial, in netlist order
+    for (i=0; i<table->scatter_size; ++i) {
+        struct source_scatter *s = &table->scatter[i];
+        analysis->mna_vector[s->row] = s->sign * table->value[s->slot];
+        if (s->shift)
+            analysis->mna_vector[s->row] += s->shift;
+    }
+}
+
 static void analysis_transient_euler_init(struct analysis_info *analysis,
                                           struct cmd_tran *transient) {
     DEBUG_MSG("")
@@ -1414,25 +2457,27 @@ static void analysis_transient_euler_init(struct analysis_info *analysis,
     dfloat_t h = 1/transient->time_step;
 
     if (use_sparse) {
-        cs *orig_mna_matrix = analysis->cs_mna_matrix;
-        analysis->cs_mna_matrix =
-            cs_add(analysis->cs_mna_matrix,analysis->cs_transient_matrix,1,h);
-        cs_free(orig_mna_matrix);
+        //G and C share their pattern, see analysis_init()
+        dfloat_t *G = analysis->cs_mna_matrix->x;
+        dfloat_t *C = analysis->cs_transient_matrix->x;
+        unsigned long nonzeros = analysis->cs_mna_matrix->p[mna_dim_size];
+        unsigned long k;
+
+        _dot_add(G,G,h,C,nonzeros);
         decomp_LU_sparse(analysis);
 
         //compute h*C
-        cs *orig_transient_matrix = analysis->cs_transient_matrix;
-        analysis->cs_transient_matrix =
-            cs_add(analysis->cs_transient_matrix,analysis->cs_transient_matrix,h,0);
-        cs_free(orig_transient_matrix);
+        for (k=0; k<nonzeros; ++k)
+            C[k] *= h;
     }
     else {
+        unsigned long values = dense_values(analysis,mna_dim_size);
         _dot_add(analysis->mna_matrix,analysis->mna_matrix,h,
-                 analysis->transient_matrix,mna_dim_size*mna_dim_size);
+                 analysis->transient_matrix,values);
         decomp_LU(analysis);
 
         _dot_add(analysis->transient_matrix,analysis->transient_matrix,h-1,
-                 analysis->transient_matrix,mna_dim_size*mna_dim_size);
+                 analysis->transient_matrix,values);
     }
 }
 
@@ -1443,11 +2488,7 @@ static void analyse_transient_euler_one_step(struct netlist_info *netlist,
     const int use_sparse = analysis->use_sparse;
 
     unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
-    dfloat_t *tmp = (dfloat_t *)malloc(mna_dim_size * sizeof(dfloat_t));
-    if (!tmp) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
+    dfloat_t *tmp = analysis_workspace(analysis,W_TRAN_RHS);
 
     if (use_sparse) {
         memcpy(tmp,analysis->mna_vector,mna_dim_size*sizeof(dfloat_t));
@@ -1463,7 +2504,7 @@ static void analyse_transient_euler_one_step(struct netlist_info *netlist,
         analysis->mna_vector = orig_mna_vector;
     }
     else {
-        _mult(tmp,analysis->transient_matrix,x_prev,mna_dim_size);
+        dense_mult(analysis,tmp,analysis->transient_matrix,x_prev);
         _dot_add(tmp,analysis->mna_vector,1,tmp,mna_dim_size);
 
         dfloat_t *orig_mna_vector = analysis->mna_vector;
@@ -1472,7 +2513,6 @@ static void analyse_transient_euler_one_step(struct netlist_info *netlist,
         solve_LU(analysis);
         analysis->mna_vector = orig_mna_vector;
     }
-    free(tmp);
 }
 
 static void analysis_transient_trapezoid_init(struct analysis_info *analysis,
@@ -1486,49 +2526,34 @@ static void analysis_transient_trapezoid_init(struct analysis_info *analysis,
     dfloat_t h = 2/transient->time_step;
 
     if (use_sparse) {
-        cs *tmp = analysis->cs_mna_matrix;
-        analysis->cs_mna_matrix =
-            cs_add(analysis->cs_mna_matrix,analysis->cs_transient_matrix,1,h);
+        //G and C share their pattern, see analysis_init()
+        dfloat_t *G = analysis->cs_mna_matrix->x;
+        dfloat_t *C = analysis->cs_transient_matrix->x;
+        unsigned long nonzeros = analysis->cs_mna_matrix->p[mna_dim_size];
+        unsigned long k;
+
+        //compute G + h * C and -(G - h * C)
+        for (k=0; k<nonzeros; ++k) {
+            dfloat_t g = G[k];
+            dfloat_t hc = h * C[k];
+            G[k] = g + hc;
+            C[k] = hc - g;
+        }
         decomp_LU_sparse(analysis);
-
-        //compute -(G - h * C)
-        cs *tmp2 = analysis->cs_transient_matrix;
-        analysis->cs_transient_matrix =
-            cs_add(tmp,analysis->cs_transient_matrix,-1,h);
-
-        cs_free(tmp);
-        cs_free(tmp2);
     }
     else {
-        dfloat_t *left_array = (dfloat_t *)malloc(mna_dim_size * mna_dim_size * sizeof(dfloat_t));
-        if (!left_array) {
-            perror(__FUNCTION__);
-            exit(EXIT_FAILURE);
-        }
-
-        dfloat_t *right_array = (dfloat_t *)malloc(mna_dim_size * mna_dim_size * sizeof(dfloat_t));
-        if (!right_array) {
-            perror(__FUNCTION__);
-            exit(EXIT_FAILURE);
+        dfloat_t *G = analysis->mna_matrix;
+        dfloat_t *C = analysis->transient_matrix;
+        unsigned long k;
+
+        //compute G + h * C and G - h * C in place
+        for (k=0; k<dense_values(analysis,mna_dim_size); ++k) {
+            dfloat_t g = G[k];
+            dfloat_t hc = h * C[k];
+            G[k] = g + hc;
+            C[k] = g - hc;
         }
 
-        //calculate G + h * C
-        _dot_add(left_array,analysis->mna_matrix,h,
-                 analysis->transient_matrix,mna_dim_size*mna_dim_size);
-
-        //calculate G - h * C
-        _dot_add(right_array,analysis->mna_matrix,-h,
-                 analysis->transient_matrix,mna_dim_size*mna_dim_size);
-
-        dfloat_t *old;
-        old = analysis->mna_matrix;
-        analysis->mna_matrix = left_array;
-        free(old);
-
-        old = analysis->transient_matrix;
-        analysis->transient_matrix = right_array;
-        free(old);
-
         decomp_LU(analysis);
     }
 }
@@ -1541,18 +2566,16 @@ static void analyse_transient_trapezoid_one_step(struct netlist_info *netlist,
     const int use_sparse = analysis->use_sparse;
 
     unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
-    dfloat_t *tmp = (dfloat_t *)malloc(mna_dim_size * sizeof(dfloat_t));
-    if (!tmp) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
+    dfloat_t *tmp = analysis_workspace(analysis,W_TRAN_RHS);
 
     if (use_sparse) {
-        if (!cs_gaxpy(analysis->cs_transient_matrix,x_prev,vector_prev)) {
+        //vector_prev is the other half of the mna_vector double buffer,
+        //leave it alone
+        _dot_add(tmp,vector_prev,1,analysis->mna_vector,mna_dim_size);
+        if (!cs_gaxpy(analysis->cs_transient_matrix,x_prev,tmp)) {
             printf("cs_gaxpy() failed - exit.\n");
             exit(EXIT_FAILURE);
         }
-        _dot_add(tmp,vector_prev,1,analysis->mna_vector,mna_dim_size);
 
         dfloat_t *orig_mna_vector = analysis->mna_vector;
         analysis->mna_vector = tmp;
@@ -1561,7 +2584,7 @@ static void analyse_transient_trapezoid_one_step(struct netlist_info *netlist,
         analysis->mna_vector = orig_mna_vector;
     }
     else {
-        _mult(tmp,analysis->transient_matrix,x_prev,mna_dim_size);
+        dense_mult(analysis,tmp,analysis->transient_matrix,x_prev);
         _dot_add(tmp,vector_prev,-1,tmp,mna_dim_size);
         _dot_add(tmp,analysis->mna_vector,1,tmp,mna_dim_size);
 
@@ -1571,7 +2594,6 @@ static void analyse_transient_trapezoid_one_step(struct netlist_info *netlist,
         solve_LU(analysis);
         analysis->mna_vector = orig_mna_vector;
     }
-    free(tmp);
 }
 
 void analyse_transient(struct cmd_tran *transient,
@@ -1581,11 +2603,13 @@ void analyse_transient(struct cmd_tran *transient,
 
     //we are at dc point, see analyse_mna()
     unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
-    dfloat_t *x_prev = (dfloat_t *)malloc(mna_dim_size * sizeof(dfloat_t));
-    if (!x_prev) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
+
+    //double buffers, every step swaps the pointers instead of copying
+    dfloat_t *orig_x = analysis->x;
+    dfloat_t *orig_mna_vector = analysis->mna_vector;
+    dfloat_t *x_prev = analysis_workspace(analysis,W_TRAN_X);
+    dfloat_t *vector_prev = analysis_workspace(analysis,W_TRAN_VECTOR);
+    dfloat_t *swap;
 
     unsigned long i;
     unsigned long time_slots = ceil(transient->fin_time/transient->time_step);
@@ -1593,29 +2617,32 @@ void analyse_transient(struct cmd_tran *transient,
     switch (_transient_method) {
     case T_NONE:  assert(0);  break;
     case T_TR: {
-        dfloat_t *vector_prev = (dfloat_t *)malloc(mna_dim_size * sizeof(dfloat_t));
-        if (!vector_prev) {
-            perror(__FUNCTION__);
-            exit(EXIT_FAILURE);
-        }
+        //the sources rewrite only their own entries,
+        //both halves keep the rest of the dc vector
+        memcpy(vector_prev,analysis->mna_vector,mna_dim_size * sizeof(dfloat_t));
 
         analysis_transient_trapezoid_init(analysis,transient);
         for (i=0; i<time_slots; ++i) {
-            memcpy(x_prev,analysis->x,mna_dim_size * sizeof(dfloat_t));
-            memcpy(vector_prev,analysis->mna_vector,mna_dim_size * sizeof(dfloat_t));
+            swap = x_prev;
+            x_prev = analysis->x;
+            analysis->x = swap;
+            swap = vector_prev;
+            vector_prev = analysis->mna_vector;
+            analysis->mna_vector = swap;
             dfloat_t abs_time = i * transient->time_step;
             analyse_transient_update(netlist,analysis,abs_time);
             analyse_transient_trapezoid_one_step(netlist,analysis,x_prev,
                                                  vector_prev,transient->time_step);
             write_results(netlist,analysis,abs_time);
         }
-        free(vector_prev);
         break;
     }
     case T_BE:
         analysis_transient_euler_init(analysis,transient);
         for (i=0; i<time_slots; ++i) {
-            memcpy(x_prev,analysis->x,mna_dim_size * sizeof(dfloat_t));
+            swap = x_prev;
+            x_prev = analysis->x;
+            analysis->x = swap;
             dfloat_t abs_time = i * transient->time_step;
             analyse_transient_update(netlist,analysis,abs_time);
             analyse_transient_euler_one_step(netlist,analysis,x_prev,
@@ -1625,7 +2652,472 @@ void analyse_transient(struct cmd_tran *transient,
         break;
     }
 
-    free(x_prev);
+    //hand the last point back in the original buffers
+    if (analysis->x != orig_x) {
+        memcpy(orig_x,analysis->x,mna_dim_size * sizeof(dfloat_t));
+        analysis->x = orig_x;
+    }
+    if (analysis->mna_vector != orig_mna_vector) {
+        memcpy(orig_mna_vector,analysis->mna_vector,mna_dim_size * sizeof(dfloat_t));
+        analysis->mna_vector = orig_mna_vector;
+    }
+}
+
+#define TRAN_SAFETY 0.9
+#define TRAN_INIT_LEVEL -3
+
+/* Timesteps are kept on the levels h = time_step * 2^level, so a linear
+   circuit only needs a handful of different G + alpha * C factorizations.
+   The sparse ones are kept per level (filled on demand), going back to a
+   previous level is free. Steps cut short by a breakpoint share one
+   scratch slot.
+*/
+
+struct tran_factor {
+    dfloat_t alpha;
+    csn **N;  //one per block, see transient_factor_ref()
+};
+
+static inline int transient_factor_size(struct analysis_info *analysis) {
+    return analysis->cs_blocks ? analysis->cs_blocks_size : 1;
+}
+
+static inline csn **transient_factor_ref(struct analysis_info *analysis, int b) {
+    //where decomp_LU_sparse() leaves the numeric factorization
+    return analysis->cs_blocks ? &analysis->cs_blocks[b].N : &analysis->cs_mna_N;
+}
+
+static void transient_factor(struct analysis_info *analysis,
+                             struct tran_factor *slot,
+                             cs *cs_A, cs *cs_G, cs *cs_C,
+                             dfloat_t *G, dfloat_t *C, const dfloat_t alpha) {
+    //factorize G + alpha * C
+    DEBUG_MSG("")
+    unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
+
+    if (!analysis->use_sparse) {
+        _dot_add(analysis->mna_matrix,G,alpha,C,dense_values(analysis,mna_dim_size));
+        decomp_LU(analysis);
+        return;
+    }
+
+    int size = transient_factor_size(analysis);
+    int b;
+    if (slot->N && slot->alpha == alpha) {
+        for (b=0; b<size; ++b)
+            *transient_factor_ref(analysis,b) = slot->N[b];
+        return;
+    }
+
+    //the slots own the numeric factorizations, not analysis, the one of
+    //the dc point is gone, see analyse_transient_adaptive()
+    for (b=0; b<size; ++b)
+        *transient_factor_ref(analysis,b) = NULL;
+    if (slot->N)
+        for (b=0; b<size; ++b)
+            slot->N[b] = cs_nfree(slot->N[b]);
+
+    //G, C and A share one pattern, the ordering of the dc point is reused
+    //unless it was a cholesky one
+    _dot_add(cs_A->x,cs_G->x,alpha,cs_C->x,cs_G->p[mna_dim_size]);
+    analysis->cs_mna_matrix = cs_A;
+    decomp_LU_sparse(analysis);
+
+    //the first LU may have split the system into blocks
+    size = transient_factor_size(analysis);
+    if (!slot->N) {
+        slot->N = (csn **)calloc(size,sizeof(csn *));
+        if (!slot->N) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+    }
+    slot->alpha = alpha;
+    for (b=0; b<size; ++b)
+        slot->N[b] = *transient_factor_ref(analysis,b);
+}
+
+static void transient_mult(struct analysis_info *analysis,
+                           cs *cs_A, dfloat_t *A, dfloat_t *x, dfloat_t *y) {
+    //y = A * x
+    unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
+
+    if (analysis->use_sparse) {
+        memset(y,0,mna_dim_size*sizeof(dfloat_t));
+        if (!cs_gaxpy(cs_A,x,y)) {
+            printf("cs_gaxpy() failed - exit.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+        dense_mult(analysis,y,A,x);
+}
+
+static void transient_diag(struct analysis_info *analysis,
+                           cs *cs_A, dfloat_t *A, dfloat_t *d) {
+    //d = |diag(A)|
+    unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
+    unsigned long i;
+
+    memset(d,0,mna_dim_size*sizeof(dfloat_t));
+    if (analysis->use_sparse) {
+        int j,p;
+        for (j=0; j<cs_A->n; ++j)
+            for (p=cs_A->p[j]; p<cs_A->p[j+1]; ++p)
+                if (cs_A->i[p] == j)
+                    d[j] += cs_A->x[p];
+        for (i=0; i<mna_dim_size; ++i)
+            d[i] = fabs(d[i]);
+    }
+    else {
+        const struct dense_band *band = analysis->use_band ? &analysis->band : NULL;
+        for (i=0; i<mna_dim_size; ++i)
+            d[i] = fabs(*dense_entry(A,mna_dim_size,band,i,i));
+    }
+}
+
+static dfloat_t transient_lte_ratio(struct analysis_info *analysis,
+                                    const int order, dfloat_t *q, dfloat_t **hist,
+                                    dfloat_t *c_diag,
+                                    const dfloat_t h, dfloat_t *h_hist) {
+    //estimate the local truncation error from the divided differences of
+    //the charges/fluxes q = C * x of the last accepted points (as spice),
+    //they stay continuous even if a source jumps. Returns max(|lte| / tolerance)
+    //over all rows with capacitance, the step is good enough if the ratio is <= 1
+
+    unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
+    const dfloat_t reltol = analysis->reltol;
+    const dfloat_t abstol = analysis->abstol;
+    dfloat_t ratio = 0;
+    unsigned long i;
+
+    for (i=0; i<mna_dim_size; ++i) {
+        if (c_diag[i] == 0)
+            continue;
+
+        dfloat_t dd1_a = (q[i] - hist[0][i]) / h;
+        dfloat_t dd1_b = (hist[0][i] - hist[1][i]) / h_hist[0];
+        dfloat_t dd2_a = (dd1_a - dd1_b) / (h + h_hist[0]);
+        dfloat_t lte;
+
+        if (order == 1) {
+            //backward euler: h^2/2 * q''
+            lte = h * h * dd2_a;
+        }
+        else {
+            //trapezoidal: h^3/12 * q'''
+            dfloat_t dd1_c = (hist[1][i] - hist[2][i]) / h_hist[1];
+            dfloat_t dd2_b = (dd1_b - dd1_c) / (h_hist[0] + h_hist[1]);
+            dfloat_t dd3 = (dd2_a - dd2_b) / (h + h_hist[0] + h_hist[1]);
+            lte = h * h * h * dd3 / 2;
+        }
+
+        //abstol is in volts/amperes, scale it with the row capacitance
+        dfloat_t ref = fmax(fabs(q[i]),fabs(hist[0][i]));
+        dfloat_t r = fabs(lte) / (reltol * ref + abstol * c_diag[i]);
+        if (r > ratio)
+            ratio = r;
+    }
+    return ratio;
+}
+
+static int breakpoint_cmp(const void *a, const void *b) {
+    dfloat_t x = *(const dfloat_t *)a;
+    dfloat_t y = *(const dfloat_t *)b;
+    return (x > y) - (x < y);
+}
+
+static dfloat_t *transient_breakpoints(struct netlist_info *netlist,
+                                       const dfloat_t fin_time,
+                                       const dfloat_t min_dist,
+                                       unsigned long *size) {
+    //merge the breakpoints of every transient source into one sorted
+    //table, points closer than min_dist are merged
+    DEBUG_MSG("")
+    struct _transient_ *tran;
+    unsigned long total = 0;
+    unsigned long i;
+
+    for (i=0; i<netlist->el_group1_size; ++i) {
+        struct element *el = &netlist->el_group1_pool[i];
+        if (el->type == 'i' && (tran = el->i->transient))
+            total += analysis_transient_breakpoints(tran,fin_time,min_dist,NULL);
+    }
+    for (i=0; i<netlist->el_group2_size; ++i) {
+        struct element *el = &netlist->el_group2_pool[i];
+        if (el->type == 'v' && (tran = el->v->transient))
+            total += analysis_transient_breakpoints(tran,fin_time,min_dist,NULL);
+    }
+
+    //fin_time closes the table
+    dfloat_t *bp = (dfloat_t *)malloc((total + 1) * sizeof(dfloat_t));
+    if (!bp) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long next = 0;
+    for (i=0; i<netlist->el_group1_size; ++i) {
+        struct element *el = &netlist->el_group1_pool[i];
+        if (el->type == 'i' && (tran = el->i->transient))
+            next += analysis_transient_breakpoints(tran,fin_time,min_dist,&bp[next]);
+    }
+    for (i=0; i<netlist->el_group2_size; ++i) {
+        struct element *el = &netlist->el_group2_pool[i];
+        if (el->type == 'v' && (tran = el->v->transient))
+            next += analysis_transient_breakpoints(tran,fin_time,min_dist,&bp[next]);
+    }
+    assert(next == total);
+
+    qsort(bp,total,sizeof(dfloat_t),breakpoint_cmp);
+
+    unsigned long unique = 0;
+    for (i=0; i<total; ++i) {
+        if (bp[i] < min_dist || bp[i] > fin_time - min_dist)
+            continue;
+        if (unique && bp[i] - bp[unique-1] < min_dist)
+            continue;
+        bp[unique++] = bp[i];
+    }
+    bp[unique++] = fin_time;
+
+    *size = unique;
+    return bp;
+}
+
+void analyse_transient_adaptive(struct cmd_tran *transient,
+                                struct netlist_info *netlist,
+                                struct analysis_info *analysis) {
+    DEBUG_MSG("")
+    const int use_sparse = analysis->use_sparse;
+    const enum transient_method _transient_method = analysis->_transient_method;
+    assert(_transient_method != T_NONE);
+
+    //backward euler is first order, trapezoidal second order
+    const int order = (_transient_method == T_TR) ? 2 : 1;
+    const dfloat_t fin_time = transient->fin_time;
+    const dfloat_t time_step = transient->time_step;
+
+    //largest step is fin_time/50 (as spice), never below the .tran step
+    int level_max = 0;
+    while (ldexp(time_step,level_max + 1) <= fin_time/50)
+        level_max++;
+    int level_min = 0;
+    while (ldexp(time_step,level_min - 1) >= fin_time * 1e-9)
+        level_min--;
+
+    //we are at dc point, see analyse_mna()
+    unsigned long mna_dim_size = analysis->n + analysis->el_group2_size;
+    unsigned long vector_size = mna_dim_size * sizeof(dfloat_t);
+
+    //keep G and C, every timestep change needs G + alpha * C
+    cs *cs_G = analysis->cs_mna_matrix;
+    cs *cs_C = analysis->cs_transient_matrix;
+    //G + alpha * C, on the pattern of G and C
+    cs *cs_A = NULL;
+    if (use_sparse)
+        cs_A = cs_share_pattern(cs_G);
+    dfloat_t *G = NULL;
+    dfloat_t *C = analysis->transient_matrix;
+    if (!use_sparse) {
+        G = (dfloat_t *)malloc(dense_values(analysis,mna_dim_size) * sizeof(dfloat_t));
+        if (!G) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(G,analysis->mna_matrix,dense_values(analysis,mna_dim_size) * sizeof(dfloat_t));
+    }
+
+    //factors[0] is the scratch slot, then one slot per level
+    const int factors_size = level_max - level_min + 2;
+    struct tran_factor *factors =
+        (struct tran_factor *)calloc(factors_size,sizeof(struct tran_factor));
+    if (!factors) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    if (use_sparse) {
+        //the slots own the factorizations from here on, drop the one of
+        //the dc point
+        int size = transient_factor_size(analysis);
+        int b;
+        for (b=0; b<size; ++b) {
+            csn **N = transient_factor_ref(analysis,b);
+            *N = cs_nfree(*N);
+        }
+    }
+
+    //hist[0] is C * x of the last accepted point, hist[1] the one before, ...
+    dfloat_t *hist[3];
+    dfloat_t h_hist[2] = { 0, 0 };
+    //trapezoidal keeps C * dx/dt of the last accepted point instead of
+    //b_prev - G * x_prev, rows without capacitance cannot ring then
+    dfloat_t *dx_prev = (dfloat_t *)calloc(mna_dim_size,sizeof(dfloat_t));
+    dfloat_t *rhs = (dfloat_t *)malloc(vector_size);
+    dfloat_t *Cx = (dfloat_t *)malloc(vector_size);
+    dfloat_t *c_diag = (dfloat_t *)malloc(vector_size);
+    hist[0] = (dfloat_t *)malloc(vector_size);
+    hist[1] = (dfloat_t *)malloc(vector_size);
+    hist[2] = (dfloat_t *)malloc(vector_size);
+    if (!dx_prev || !rhs || !Cx || !c_diag || !hist[0] || !hist[1] || !hist[2]) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    transient_diag(analysis,cs_C,C,c_diag);
+
+    //a step ending closer than the smallest step to a breakpoint lands on
+    //it, the step left after it would be a few ulps
+    const dfloat_t bp_tol = ldexp(time_step,level_min);
+    unsigned long bp_size;
+    unsigned long bp_next = 0;
+    dfloat_t *bp = transient_breakpoints(netlist,fin_time,bp_tol,&bp_size);
+
+    //dc operating point, dx/dt = 0
+    dfloat_t abs_time = 0;
+    transient_mult(analysis,cs_C,C,analysis->x,hist[0]);
+    write_results(netlist,analysis,abs_time);
+    unsigned long hist_size = 1;
+
+    unsigned long accepted = 0;
+    unsigned long rejected = 0;
+    unsigned long forced = 0;
+
+    //start small, the error control grows the step when it is safe
+    int level = (TRAN_INIT_LEVEL < level_max) ? TRAN_INIT_LEVEL : level_max;
+    if (level < level_min)
+        level = level_min;
+    dfloat_t h_factored = 0;
+    dfloat_t alpha = 0;
+
+    while (abs_time < fin_time) {
+        dfloat_t h_step = ldexp(time_step,level);
+        dfloat_t new_time = abs_time + h_step;
+        int truncated = 0;
+        //land exactly on the next breakpoint (the last one is fin_time)
+        if (bp[bp_next] - new_time < bp_tol) {
+            new_time = bp[bp_next];
+            h_step = new_time - abs_time;
+            truncated = 1;
+        }
+        if (h_step != h_factored) {
+            alpha = (order == 2) ? 2/h_step : 1/h_step;
+            struct tran_factor *slot =
+                truncated ? &factors[0] : &factors[1 + level - level_min];
+            transient_factor(analysis,slot,cs_A,cs_G,cs_C,G,C,alpha);
+            h_factored = h_step;
+        }
+
+        analyse_transient_update(netlist,analysis,new_time);
+
+        //backward euler:  (G + C/h) x = b + C/h * x_prev
+        //trapezoidal:     (G + 2C/h) x = b + 2C/h * x_prev + C * dx_prev/dt
+        _dot_add(rhs,analysis->mna_vector,alpha,hist[0],mna_dim_size);
+        if (order == 2)
+            _dot_add(rhs,rhs,1,dx_prev,mna_dim_size);
+
+        dfloat_t *orig_mna_vector = analysis->mna_vector;
+        analysis->mna_vector = rhs;
+        if (use_sparse)
+            solve_LU_sparse(analysis);
+        else
+            solve_LU(analysis);
+        analysis->mna_vector = orig_mna_vector;
+
+        transient_mult(analysis,cs_C,C,analysis->x,Cx);
+
+        int next_level = level;
+        if (hist_size > (unsigned long)order) {
+            dfloat_t ratio =
+                transient_lte_ratio(analysis,order,Cx,hist,c_diag,h_step,h_hist);
+            //optimal step is h * factor
+            dfloat_t factor = (ratio > 0) ?
+                TRAN_SAFETY * pow(ratio,-1.0/(order + 1)) : 2;
+
+            if (ratio > 1 && level > level_min) {
+                //reject, retry from the last accepted point
+                rejected++;
+                int shrink = (int)ceil(-log2(factor));
+                level -= (shrink > 1) ? shrink : 1;
+                if (level < level_min)
+                    level = level_min;
+                continue;
+            }
+            if (ratio > 1) {
+                //the charges jump (e.g. a voltage source across a capacitor),
+                //smaller steps do not help
+                if (!forced)
+                    printf("***  WARNING  ***    timestep too small at time %g, step accepted\n",new_time);
+                forced++;
+            }
+            else if (factor >= 2 && !truncated && level < level_max)
+                next_level = level + 1;
+        }
+
+        //accept
+        accepted++;
+        if (order == 2) {
+            //C * dx/dt = 2/h * C * (x - x_prev) - C * dx_prev/dt
+            unsigned long i;
+            for (i=0; i<mna_dim_size; ++i)
+                dx_prev[i] = alpha * (Cx[i] - hist[0][i]) - dx_prev[i];
+        }
+        dfloat_t *swap = hist[2];
+        hist[2] = hist[1];
+        hist[1] = hist[0];
+        hist[0] = Cx;
+        Cx = swap;
+        h_hist[1] = h_hist[0];
+        h_hist[0] = h_step;
+        if (hist_size < 3)
+            hist_size++;
+        abs_time = new_time;
+        write_results(netlist,analysis,abs_time);
+
+        level = next_level;
+        if (bp[bp_next] - abs_time < bp_tol) {
+            //the sources have a corner here, the divided differences
+            //across it are meaningless, start over with a small step
+            bp_next++;
+            hist_size = 1;
+            if (level > TRAN_INIT_LEVEL)
+                level = (TRAN_INIT_LEVEL > level_min) ? TRAN_INIT_LEVEL : level_min;
+        }
+    }
+
+    printf("INFO : %-24s(): %lu accepted, %lu rejected timesteps, %lu breakpoints\n",
+           __FUNCTION__,accepted,rejected,bp_size - 1);
+
+    //leave G in place of the last factorized matrix
+    if (use_sparse) {
+        int size = transient_factor_size(analysis);
+        int i;
+        int b;
+        for (i=0; i<factors_size; ++i) {
+            if (!factors[i].N)
+                continue;
+            for (b=0; b<size; ++b)
+                cs_nfree(factors[i].N[b]);
+            free(factors[i].N);
+        }
+        for (b=0; b<size; ++b)
+            *transient_factor_ref(analysis,b) = NULL;
+        cs_free_shared(cs_A);
+        analysis->cs_mna_matrix = cs_G;
+    }
+    else {
+        memcpy(analysis->mna_matrix,G,dense_values(analysis,mna_dim_size) * sizeof(dfloat_t));
+        free(G);
+    }
+
+    free(factors);
+    free(dx_prev);
+    free(rhs);
+    free(Cx);
+    free(c_diag);
+    free(bp);
+    free(hist[0]);
+    free(hist[1]);
+    free(hist[2]);
 }
 
 void analyse_mna(struct netlist_info *netlist, struct analysis_info *analysis) {
@@ -1634,33 +3126,77 @@ void analyse_mna(struct netlist_info *netlist, struct analysis_info *analysis) {
 
     memset(analysis,0,sizeof(struct analysis_info));
 
-    analysis->use_sparse = get_sparse(netlist->cmd_pool,netlist->cmd_pool_size);
-    analysis->_solver =
-        get_solver(netlist->cmd_pool,netlist->cmd_pool_size,analysis->use_sparse);
     analysis->_transient_method =
         get_transient_method(netlist->cmd_pool,netlist->cmd_pool_size);
     analysis->tol = get_tolerance(netlist->cmd_pool,netlist->cmd_pool_size);
+    analysis->adaptive =
+        get_option_flag(netlist->cmd_pool,netlist->cmd_pool_size,CMD_OPT_ADAPTIVE);
+    analysis->reltol =
+        get_option_value(netlist->cmd_pool,netlist->cmd_pool_size,
+                         CMD_OPT_RELTOL,DEFAULT_RELTOL);
+    analysis->abstol =
+        get_option_value(netlist->cmd_pool,netlist->cmd_pool_size,
+                         CMD_OPT_ABSTOL,DEFAULT_ABSTOL);
+
+    struct command *dc_cmd = get_dc(netlist->cmd_pool,netlist->cmd_pool_size);
+
+    //fold the constant voltage sources, assemble what is left
+    struct topology *t = &analysis->topology;
+    int relabel =
+        get_option_flag(netlist->cmd_pool,netlist->cmd_pool_size,CMD_OPT_RCM);
+    topology_reduce(netlist,t,analysis->_transient_method != T_NONE,
+                    dc_cmd ? dc_cmd->dc.source._el : NULL,relabel);
+    struct netlist_info *system = netlist;
+    if (t->active) {
+        char msg[128];
+        if (t->tree_size) {
+            snprintf(msg,sizeof(msg),"removed %lu voltage sources, %lu nodes left",
+                     t->tree_size,t->netlist.n - 1);
+            MSG(msg)
+        }
+        if (relabel) {
+            snprintf(msg,sizeof(msg),"rcm: node bandwidth %lu -> %lu",
+                     t->bandwidth[0],t->bandwidth[1]);
+            MSG(msg)
+        }
+        system = &t->netlist;
+    }
 
-    if (analysis->use_sparse)
-        DEBUG_MSG("use sparse matrices");
+    //storage from the size of the system, then the solver for it
+    analysis->use_sparse = get_sparse(system,analysis);
+    analysis->_solver =
+        get_solver(netlist->cmd_pool,netlist->cmd_pool_size,analysis->use_sparse);
+    MSG(solver_base[analysis->_solver])
 
-    analysis_init(netlist,analysis);
+    analysis_init(system,analysis);
     analyse_log(analysis);
 
-    open_logfiles(netlist);
+    open_logfiles(netlist,
+                  get_option_flag(netlist->cmd_pool,netlist->cmd_pool_size,CMD_OPT_BINARY));
 
-    struct command *dc_cmd = get_dc(netlist->cmd_pool,netlist->cmd_pool_size);
     if (dc_cmd)
         analyse_dc(&dc_cmd->dc,netlist,analysis);
     else {
         analyse_dc_one_step(netlist,analysis);
         if (analysis->_transient_method != T_NONE) {
             struct command *tran_cmd = get_tran(netlist->cmd_pool,netlist->cmd_pool_size);
-            analyse_transient(&tran_cmd->transient,netlist,analysis);
+            source_table_init(netlist,analysis);
+            if (analysis->adaptive)
+                analyse_transient_adaptive(&tran_cmd->transient,netlist,analysis);
+            else
+                analyse_transient(&tran_cmd->transient,netlist,analysis);
         }
     }
 
     close_logfiles(netlist);
+
+    //report every node and branch of the netlist
+    if (t->active) {
+        topology_expand(netlist,t,analysis->x);
+        analysis->x = t->x;
+        analysis->n = t->n;
+        analysis->el_group2_size = t->el_group2_size;
+    }
 }
 
 void fprint_dfloat_array(const char *filename,
@@ -2,8 +2,10 @@
 #define __ANALYSIS_H__
 
 #include "datatypes.h"
+#include "topology.h"
 #include <gsl/gsl_permutation.h>
 #include "csparse/csparse.h"
+#include "supernodal.h"
 
 enum solver {
     S_LU = 0,
@@ -23,6 +25,101 @@ enum transient_method {
     T_BE   //backward-euler
 };
 
+//scratch vectors of analysis_info.workspace, mna_dim_size each
+enum workspace_slot {
+    W_SOLVE = 0,  //permuted sparse and banded solves
+
+    //iterative solvers
+    W_ITER_R,
+    W_ITER_Z,
+    W_ITER_M,
+    W_ITER_P,
+    W_ITER_Q,
+    W_ITER_R_,
+    W_ITER_Z_,
+    W_ITER_P_,
+    W_ITER_Q_,
+
+    //fixed step transient
+    W_TRAN_X,
+    W_TRAN_VECTOR,
+    W_TRAN_RHS,
+
+    W_SIZE
+};
+
+//where a source value goes in mna_vector
+struct source_scatter {
+    unsigned long row;
+    unsigned long slot;  //in source_table.value
+    dfloat_t sign;
+    dfloat_t shift;  //folded by the topology pre-pass, see topology.h
+};
+
+//the transient sources grouped by waveform type, see source_table_init()
+struct source_table {
+    unsigned long exp_size;
+    unsigned long sin_size;
+    unsigned long pulse_size;
+    unsigned long pwl_size;
+    struct transient_exp *exp;
+    struct transient_sin *sin;
+    struct transient_pulse *pulse;
+    struct transient_pwl *pwl;
+
+    dfloat_t *value;  //exp values first, then sin, pulse and pwl
+
+    //in netlist order, the last source on a row wins
+    unsigned long scatter_size;
+    struct source_scatter *scatter;
+};
+
+/* Where the stamps of the linear devices go in the values (Ax) of a sparse
+   matrix, see assemble_sparse(). Four entries per device, (a,a) (b,b) (a,b)
+   (b,a) for r and c, (a,col) (col,a) (b,col) (col,b) for the branches of v
+   and l, one (col,col) for the -L of l. -1 for stamps on the ground node.
+   stamps tells which of G and C the matrix has. */
+struct stamp_map {
+    int stamps;  //STAMP_G | STAMP_C
+    int *r;
+    int *c;
+    int *v;
+    int *l;
+    int *l_diag;
+};
+
+/* An independent part of the sparse system, one or more connected
+   components of its graph. The sparse LU factors and solves the
+   blocks on their own and in parallel, see sparse_blocks_init(). */
+struct cs_block {
+    int size;
+    int *unknowns;  //rows of the block in the full system, ascending
+    cs *A;          //the block, its values gathered from cs_mna_matrix
+    int *gather;    //slot in cs_mna_matrix->x of every value of A
+    css *S;
+    csn *N;
+    dfloat_t *w;    //2 * size, the right hand side and the solution
+};
+
+/* Banded dense storage, see band_order(). The unknowns are reordered so
+   that the branches come right after the last of their nodes, band is the
+   largest |row - col| of a stamp in that order. Row i of G and C keeps the
+   columns i - band .. i + band, row i of the LU factors the columns
+   i - band .. i + 2 * band (the row interchanges widen U). The loops only
+   run over the skyline inside the band, the iterative solvers multiply
+   with it as well. The nodes keep their labels, with .option rcm those
+   are the Reverse Cuthill-McKee order of the topology pass. */
+struct dense_band {
+    unsigned long band;
+    unsigned long width;    //2 * band + 1, values per row of G and C
+    unsigned long *perm;    //unknown -> row of the band order
+    unsigned long *first;   //first column of every row of G and C
+    unsigned long *last;    //last column of every row of G and C
+    unsigned long *pivot;   //row interchanged with at every step of the LU
+    unsigned long *u_last;  //last column of every row of U
+    unsigned long *l_last;  //last row of every column of L
+};
+
 struct analysis_info {
     int error;
 
@@ -51,20 +148,46 @@ struct analysis_info {
 
     dfloat_t *decomp;
 
+    dfloat_t *workspace;  //W_SIZE scratch vectors, allocated once
+
     //sparse matrix members
     cs *cs_mna_matrix;        //G
-    cs *cs_transient_matrix;  //C
+    cs *cs_transient_matrix;  //C, on the pattern of G
+    struct stamp_map cs_map;  //G and C, see analysis_restamp()
     csn *cs_mna_N;
     css *cs_mna_S;
+    unsigned long cs_mna_S_key;  //sparsity pattern cs_mna_S was computed for
+    cs *cs_mna_S_pattern;        //a copy of it, no values
+    int cs_mna_S_order;          //cs_sqr() order of cs_mna_S, 1 for cs_mna_L
+    int cs_blocks_size;          //0 for a connected system
+    struct cs_block *cs_blocks;  //used instead of cs_mna_S and cs_mna_N
+    struct supernodal *cs_mna_L;  //sparse cholesky, see supernodal.h
 
     int use_sparse;
+    int use_band;  //dense storage only, G, C and decomp are banded
+    struct dense_band band;
     enum solver _solver;
     enum transient_method _transient_method;
     dfloat_t tol;
+
+    struct source_table sources;
+
+    struct topology topology;  //removed voltage sources, see analyse_mna()
+
+    //adaptive timestep control
+    int adaptive;
+    dfloat_t reltol;
+    dfloat_t abstol;
 };
 
 void analyse_mna(struct netlist_info *netlist, struct analysis_info *analysis);
 
+//restamp G and C after the values of the devices of netlist changed,
+//netlist is the one the matrices were assembled from (the reduced one of
+//analysis->topology when it is active), so it is valid between
+//analysis_init() and the expansion of x at the end of analyse_mna()
+void analysis_restamp(struct netlist_info *netlist, struct analysis_info *analysis);
+
 void print_dfloat_array(unsigned long row, unsigned long col, dfloat_t *p);
 
 #endif
@@ -32,6 +32,13 @@ enum cmd_option_type {
     CMD_OPT_SPARSE,
     CMD_OPT_METHOD_TR,
     CMD_OPT_METHOD_BE,
+    CMD_OPT_ADAPTIVE,
+    CMD_OPT_RELTOL,
+    CMD_OPT_ABSTOL,
+    CMD_OPT_BINARY,
+    CMD_OPT_DENSE,
+    CMD_OPT_MEMBUDGET,
+    CMD_OPT_RCM,
     CMD_OPT_BAD_OPTION  //must be last
 };
 
@@ -39,6 +46,9 @@ enum cmd_option_type {
 #define CMD_OPT_SIZE (CMD_OPT_BAD_OPTION)
 
 #define DEFAULT_TOL 1e-3
+#define DEFAULT_RELTOL 1e-3
+#define DEFAULT_ABSTOL 1e-6
+#define DEFAULT_MEMBUDGET (1UL << 30)  //if the physical memory is not known
 
 struct node;
 struct element;
@@ -75,6 +85,7 @@ struct cmd_print_plot {
     struct cmd_print_plot_item item[MAX_PRINT_PLOT_ITEMS];
     char *logfile;
     FILE *f;
+    double *row;  //binary output, time and one value per item
 };
 
 struct cmd_dc {
@@ -93,7 +104,10 @@ struct command {
     enum cmd_type type;
     dfloat_t value;
     union {
-        int option[CMD_OPT_BAD_OPTION + 1];
+        struct {
+            int option[CMD_OPT_BAD_OPTION + 1];
+            dfloat_t option_value[CMD_OPT_BAD_OPTION + 1];
+        };
         struct cmd_dc dc;
         struct cmd_print_plot print_plot;
         struct cmd_tran transient;
@@ -158,6 +172,7 @@ struct transient_pwl {
     struct transient_pwl_pair *pair;
     unsigned long size;
     unsigned long next;
+    unsigned long cursor;  //segment of the last lookup
 };
 
 struct _transient_ {
@@ -253,6 +268,24 @@ struct element {
     };
 };
 
+/* The linear two terminal elements of one type as structure of arrays, in
+   pool order. Assembly streams through these instead of the elements. */
+struct device_array {
+    unsigned long size;
+    unsigned long *vplus;   //nuid
+    unsigned long *vminus;  //nuid
+    unsigned long *idx;     //pool index, the branch of group2 elements
+    dfloat_t *value;        //conductance for resistors
+};
+
+struct device_table {
+    struct device_array r;
+    struct device_array c;
+    struct device_array l;
+    struct device_array v;
+    struct device_array i;
+};
+
 struct netlist_info {
     int error;
 
@@ -275,6 +308,8 @@ struct netlist_info {
 
     unsigned long cmd_pool_size;
     struct command *cmd_pool;
+
+    struct device_table devices;
 };
 
 #endif
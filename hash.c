@@ -4,118 +4,144 @@
 #include <errno.h>
 #include <limits.h>
 #include <assert.h>
+#include <stdint.h>
 
 #include "hash.h"
 
-struct hash_table *hash_create_table(unsigned int size) {
-    struct hash_table *ht = (struct hash_table*)malloc(sizeof(struct hash_table));
-    if (!ht) {
+//grow when more than 3/4 of the slots are used
+#define HASH_LOAD_NUM 3
+#define HASH_LOAD_DEN 4
+
+static struct hash_element *hash_alloc_pool(unsigned long size) {
+    struct hash_element *pool;
+    pool = (struct hash_element*)calloc(size, sizeof(struct hash_element));
+    if (!pool) {
         perror(__FUNCTION__);
         exit(EXIT_FAILURE);
     }
+    return pool;
+}
 
-    struct hash_element **pool;
-    pool = (struct hash_element**)calloc(size, sizeof(struct hash_element*));
-    if (!pool) {
+struct hash_table *hash_create_table(unsigned long size) {
+    struct hash_table *ht = (struct hash_table*)malloc(sizeof(struct hash_table));
+    if (!ht) {
         perror(__FUNCTION__);
         exit(EXIT_FAILURE);
     }
 
-    ht->size = size;
-    ht->pool = pool;
+    //room for size keys without growing
+    unsigned long slots = 16;
+    while (slots / HASH_LOAD_DEN * HASH_LOAD_NUM < size)
+        slots <<= 1;
+
+    ht->size = slots;
+    ht->used = 0;
+    ht->pool = hash_alloc_pool(slots);
 
     return ht;
 }
 
 void hash_clean_table(struct hash_table *ht) {
-    unsigned int i;
-    for (i=0; i<ht->size; ++i) {
-        struct hash_element *root = ht->pool[i];
-        while (root) {
-            struct hash_element *next = root->next;
-            free(root->data);
-            free(root);
-            root = next;
-        }
-    }
+    unsigned long i;
+    for (i=0; i<ht->size; ++i)
+        if (ht->pool[i].key)
+            free(ht->pool[i].data);
     free(ht->pool);
     free(ht);
 }
 
-static inline
-unsigned long hash_idx(struct hash_table *ht, char *key) {
-    unsigned long idx = 0;
-    int key_size = strlen(key);
-    int capacity = sizeof(unsigned long)/sizeof(char);
-    //ignore the first chars to avoid overflow
-    int i = (key_size > capacity) ? key_size - capacity : 0;
-    while (i < key_size)
-        idx = (idx << CHAR_BIT) + key[i++];
-    idx %= ht->size;
-    return idx;
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    //64x64 -> 128 bit multiply, fold the halves (as wyhash)
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
 }
 
-void hash_insert(struct hash_table *ht, char *key, void *data) {
+unsigned long hash_string(const char *key, unsigned long key_size) {
+    const uint64_t p0 = 0xa0761d6478bd642fULL;
+    const uint64_t p1 = 0xe7037ed1a0b428dbULL;
+    const uint64_t p2 = 0x8ebc6af09c88c6e3ULL;
+    uint64_t h = key_size ^ p0;
+    uint64_t w;
+
+    //every character counts, 8 at a time
+    while (key_size >= 8) {
+        memcpy(&w,key,8);
+        h = hash_mix(h ^ w,p1);
+        key += 8;
+        key_size -= 8;
+    }
+    w = 0;
+    memcpy(&w,key,key_size);
+    h = hash_mix(h ^ w,p1);
+
+    return hash_mix(h,p2);
+}
+
+static void hash_grow(struct hash_table *ht) {
+    unsigned long size = ht->size << 1;
+    struct hash_element *pool = hash_alloc_pool(size);
+    unsigned long i;
+
+    //stored hashes, no need to hash the keys again
+    for (i=0; i<ht->size; ++i) {
+        struct hash_element *el = &ht->pool[i];
+        if (!el->key)
+            continue;
+        unsigned long idx = el->hash & (size - 1);
+        while (pool[idx].key)
+            idx = (idx + 1) & (size - 1);
+        pool[idx] = *el;
+    }
+
+    free(ht->pool);
+    ht->pool = pool;
+    ht->size = size;
+}
+
+void hash_insert_hashed(struct hash_table *ht, char *key, unsigned long hash,
+                        void *data) {
     assert(ht);
     assert(key);
     assert(data);
 
-    unsigned long idx = hash_idx(ht,key);
+    if ((ht->used + 1) * HASH_LOAD_DEN > ht->size * HASH_LOAD_NUM)
+        hash_grow(ht);
 
-    struct hash_element *el =
-        (struct hash_element*)malloc(sizeof(struct hash_element));
-    if (!el) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-    el->key = key;
-    el->data = data;
-
-    //first element
-    if (!ht->pool[idx]) {
-        el->next = NULL;
-        ht->pool[idx] = el;
-        return;
-    }
+    unsigned long mask = ht->size - 1;
+    unsigned long idx = hash & mask;
 
-    struct hash_element *root = ht->pool[idx];
-    struct hash_element *last = root;
-    int last_strcmp;
-    do {
-        last_strcmp = strcmp(key,root->key);
-        if (last_strcmp <= 0)
-            break;
-        last = root;
-        root = root->next;
-    } while (root);
-
-    if (!root) {
-        //not found, insert to hash table at the end of the list
-        el->next = NULL;
-        last->next = el;
-    }
-    else if (last_strcmp != 0) {
-        //new element, insert to hash table before root
-        el->next = last->next;
-        last->next = el;
-    }
-    else {
-        //collision, key already exists
-        printf("error: key '%s' already exists! - exit\n",key);
-        exit(EXIT_FAILURE);
+    while (ht->pool[idx].key) {
+        if (ht->pool[idx].hash == hash && strcmp(key,ht->pool[idx].key) == 0) {
+            //collision, key already exists
+            printf("error: key '%s' already exists! - exit\n",key);
+            exit(EXIT_FAILURE);
+        }
+        idx = (idx + 1) & mask;
     }
+
+    ht->pool[idx].key = key;
+    ht->pool[idx].data = data;
+    ht->pool[idx].hash = hash;
+    ht->used++;
 }
 
-void *hash_get(struct hash_table *ht, char *key) {
-    unsigned int idx = hash_idx(ht,key);
-    struct hash_element *root = ht->pool[idx];
-    while (root) {
-        int status = strcmp(key,root->key);
-        if (status == 0)
-            return root->data;
-        //else if (status < 0)
-        //    return NULL;
-        root = root->next;
+void hash_insert(struct hash_table *ht, char *key, void *data) {
+    hash_insert_hashed(ht,key,hash_string(key,strlen(key)),data);
+}
+
+void *hash_get_hashed(struct hash_table *ht, char *key, unsigned long hash) {
+    unsigned long mask = ht->size - 1;
+    unsigned long idx = hash & mask;
+
+    while (ht->pool[idx].key) {
+        //compare the strings only if the hashes match
+        if (ht->pool[idx].hash == hash && strcmp(key,ht->pool[idx].key) == 0)
+            return ht->pool[idx].data;
+        idx = (idx + 1) & mask;
     }
     return NULL;
 }
+
+void *hash_get(struct hash_table *ht, char *key) {
+    return hash_get_hashed(ht,key,hash_string(key,strlen(key)));
+}
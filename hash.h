@@ -1,20 +1,28 @@
 #ifndef __HASH_H__
 #define __HASH_H__
 
+//open addressing (linear probing), key == NULL marks an empty slot
 struct hash_element {
     char *key;
     void *data;
-    struct hash_element *next;
+    unsigned long hash;
 };
 
 struct hash_table {
-    unsigned int size;
-    struct hash_element **pool;
+    unsigned long size;  //power of 2
+    unsigned long used;
+    struct hash_element *pool;
 };
 
-struct hash_table *hash_create_table(unsigned int size);
+struct hash_table *hash_create_table(unsigned long size);
 void hash_insert(struct hash_table *ht, char *key, void *data);
 void *hash_get(struct hash_table *ht, char *key);
 void hash_clean_table(struct hash_table *ht);
 
+//same as above, for keys with a known hash_string()
+unsigned long hash_string(const char *key, unsigned long key_size);
+void hash_insert_hashed(struct hash_table *ht, char *key, unsigned long hash,
+                        void *data);
+void *hash_get_hashed(struct hash_table *ht, char *key, unsigned long hash);
+
 #endif
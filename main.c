@@ -4,12 +4,15 @@
 
 #include "parser.h"
 #include "analysis.h"
+#include "netlist_cache.h"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
 int debug_on = 0;
 int force_sparse = 0;
+int compile_only = 0;
+char *compile_output = NULL;
 
 void about() {
     printf("\n" ANSI_COLOR_RED "NAME" ANSI_COLOR_RESET "\n");
@@ -32,7 +35,10 @@ void more() {
 void options() {
     printf("\n" ANSI_COLOR_RED "OPTIONS" ANSI_COLOR_RESET "\n");
     printf("\t-d\tenable debug messages\n");
-    printf("\t-s\tforce sparse matrix storage format\n");
+    printf("\t-s\tforce sparse matrix storage format (default: chosen from the\n"
+           "\t\tsize of the circuit and .options membudget=BYTES)\n");
+    printf("\t--compile\tparse the netlist and save it as a compiled netlist\n");
+    printf("\t-o FILE\tcompiled netlist file name (default NETLIST_FILE.cnl)\n");
 }
 
 void help(int argc, char *argv[]) {
@@ -40,6 +46,7 @@ void help(int argc, char *argv[]) {
 
     printf("\n" ANSI_COLOR_RED "USAGE" ANSI_COLOR_RESET "\n");
     printf("\t%s [-d] [-s] NETLIST_FILE\n",argv[0]);
+    printf("\t%s --compile NETLIST_FILE [-o COMPILED_FILE]\n",argv[0]);
 
     options();
     authors();
@@ -66,12 +73,32 @@ void debug_info() {
 void handle_file(char *filename) {
     printf("\n================    File name: '%s    ================\n",filename);
     struct netlist_info netlist;
-    parse_file(filename,&netlist);
+    if (!compile_only && netlist_is_compiled(filename))
+        netlist_load(filename,&netlist);
+    else
+        parse_file(filename,&netlist);
     if (netlist.error) {
         printf("\nError: input file '%s' is not well defined - exit.\n",filename);
         return;
     }
 
+    if (compile_only) {
+        if (compile_output)
+            netlist_compile(filename,&netlist,compile_output);
+        else {
+            char *output = (char*)malloc(strlen(filename) + sizeof(".cnl"));
+            if (!output) {
+                perror(__FUNCTION__);
+                exit(EXIT_FAILURE);
+            }
+            strcpy(output,filename);
+            strcat(output,".cnl");
+            netlist_compile(filename,&netlist,output);
+            free(output);
+        }
+        return;
+    }
+
 #if 0
     printf("\n\n***    Circuit Elements    ***\n\n");
     print_elements(netlist.el_group1_size,netlist.el_group1_pool);
@@ -101,6 +128,16 @@ void parse_args(int argc, char *argv[]) {
         else if (!strcmp(argv[i],"-s")) {
             force_sparse = 1;
         }
+        else if (!strcmp(argv[i],"--compile")) {
+            compile_only = 1;
+        }
+        else if (!strcmp(argv[i],"-o")) {
+            if (i + 1 == argc) {
+                printf("error: missing file name after '-o' - exit.\n");
+                exit(EXIT_FAILURE);
+            }
+            compile_output = argv[++i];
+        }
     }
 }
 
@@ -115,7 +152,9 @@ int main(int argc, char *argv[]) {
     parse_args(argc,argv);
 
     for (i=1; i<argc; ++i) {
-        if (argv[i][0] != '-')
+        if (!strcmp(argv[i],"-o"))
+            ++i;  //the compiled file name
+        else if (argv[i][0] != '-')
             handle_file(argv[i]);
     }
 
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "names.h"
+#include "hash.h"
+
+#define NAME_BLOCK_SIZE (1 << 16)
+
+//grow when more than 3/4 of the slots are used, as the hash tables
+#define NAMES_LOAD_NUM 3
+#define NAMES_LOAD_DEN 4
+
+struct name_block {
+    struct name_block *next;
+    unsigned long size;
+    unsigned long used;
+    unsigned long data[];  //hash, name, '\0', padding to unsigned long
+};
+
+static struct name_slot *names_alloc_slots(unsigned long size) {
+    struct name_slot *slot =
+        (struct name_slot *)calloc(size, sizeof(struct name_slot));
+    if (!slot) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    return slot;
+}
+
+struct name_table *names_create_table(unsigned long size) {
+    struct name_table *nt = (struct name_table*)malloc(sizeof(struct name_table));
+    if (!nt) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long slots = 16;
+    while (slots / NAMES_LOAD_DEN * NAMES_LOAD_NUM < size)
+        slots <<= 1;
+
+    nt->block = NULL;
+    nt->size = slots;
+    nt->used = 0;
+    nt->slot = names_alloc_slots(slots);
+
+    return nt;
+}
+
+void names_clean_table(struct name_table *nt) {
+    struct name_block *block = nt->block;
+    while (block) {
+        struct name_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(nt->slot);
+    free(nt);
+}
+
+static void names_grow(struct name_table *nt) {
+    unsigned long size = nt->size << 1;
+    struct name_slot *slot = names_alloc_slots(size);
+    unsigned long i;
+
+    for (i=0; i<nt->size; ++i) {
+        if (!nt->slot[i].name)
+            continue;
+        unsigned long idx = nt->slot[i].hash & (size - 1);
+        while (slot[idx].name)
+            idx = (idx + 1) & (size - 1);
+        slot[idx] = nt->slot[i];
+    }
+
+    free(nt->slot);
+    nt->slot = slot;
+    nt->size = size;
+}
+
+static unsigned long *names_reserve(struct name_table *nt, unsigned long words) {
+    //room for words at the end of the current block
+    struct name_block *block = nt->block;
+    if (block && block->used + words <= block->size)
+        return &block->data[block->used];
+
+    unsigned long size = NAME_BLOCK_SIZE / sizeof(unsigned long);
+    if (size < words)
+        size = words;
+    block = (struct name_block*)malloc(sizeof(struct name_block) +
+                                       size * sizeof(unsigned long));
+    if (!block) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    block->next = nt->block;
+    block->size = size;
+    block->used = 0;
+    nt->block = block;
+    return block->data;
+}
+
+char *names_intern(struct name_table *nt, const char *s, unsigned long size) {
+    /* Copy the lowercase name to the end of the current block, the copy is
+       kept only if the name is new. */
+
+    unsigned long words = 1 + (size + sizeof(unsigned long)) / sizeof(unsigned long);
+    unsigned long *entry = names_reserve(nt,words);
+    char *name = (char *)&entry[1];
+    unsigned long i;
+    for (i=0; i<size; ++i)
+        name[i] = tolower(s[i]);
+    name[size] = '\0';
+
+    unsigned long hash = hash_string(name,size);
+    unsigned long mask = nt->size - 1;
+    unsigned long idx = hash & mask;
+    //compare the strings only if the hashes match
+    while (nt->slot[idx].name) {
+        if (nt->slot[idx].hash == hash && strcmp(nt->slot[idx].name,name) == 0)
+            return nt->slot[idx].name;
+        idx = (idx + 1) & mask;
+    }
+
+    entry[0] = hash;
+    nt->block->used += words;
+    nt->slot[idx].name = name;
+    nt->slot[idx].hash = hash;
+    nt->used++;
+    if (nt->used * NAMES_LOAD_DEN > nt->size * NAMES_LOAD_NUM)
+        names_grow(nt);
+
+    return name;
+}
+
+void names_move(struct name_table *dst, struct name_table *src) {
+    /* The blocks of src are handed to dst, its names stay valid until dst is
+       cleaned. They are not interned again in dst. */
+
+    struct name_block *tail = src->block;
+    if (tail) {
+        while (tail->next)
+            tail = tail->next;
+        if (dst->block) {
+            tail->next = dst->block->next;
+            dst->block->next = src->block;
+        }
+        else
+            dst->block = src->block;
+    }
+    src->block = NULL;
+    names_clean_table(src);
+}
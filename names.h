@@ -0,0 +1,32 @@
+#ifndef __NAMES_H__
+#define __NAMES_H__
+
+/* Interned names: every distinct (lowercase) name is stored once, in large
+   bump allocated blocks. Each name is preceded by its hash_string(), so the
+   node and element tables do not hash it again. */
+
+struct name_block;
+
+//open addressing, name == NULL marks an empty slot
+struct name_slot {
+    char *name;
+    unsigned long hash;
+};
+
+struct name_table {
+    struct name_block *block;  //current block, linked to the older ones
+    unsigned long size;  //power of 2
+    unsigned long used;
+    struct name_slot *slot;
+};
+
+struct name_table *names_create_table(unsigned long size);
+char *names_intern(struct name_table *nt, const char *s, unsigned long size);
+void names_move(struct name_table *dst, struct name_table *src);
+void names_clean_table(struct name_table *nt);
+
+static inline unsigned long name_hash(const char *name) {
+    return ((const unsigned long *)name)[-1];
+}
+
+#endif
@@ -0,0 +1,545 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "netlist_cache.h"
+#include "parser.h"
+#include "hash.h"
+#include "transient_support.h"
+
+#define IMAGE_ALIGN 8
+#define IMAGE_INIT_SIZE (1 << 16)
+#define RELOC_INIT_SIZE 1024
+
+struct image {
+    char *data;
+    unsigned long size;
+    unsigned long used;
+
+    uint64_t *reloc;
+    unsigned long reloc_size;
+    unsigned long reloc_next;
+
+    //the pools are placed first, containers resolve to offsets in them
+    unsigned long node_pool;
+    unsigned long el_group1_pool;
+    unsigned long el_group2_pool;
+};
+
+#define IMAGE_AT(img,offset) ((void*)&(img)->data[offset])
+#define IMAGE_OFFSET(img,ptr) ((unsigned long)((char*)(ptr) - (img)->data))
+
+static unsigned long image_alloc(struct image *img, unsigned long size) {
+    /* Zeroed and aligned room for size bytes. The data may move, so callers
+       keep offsets, not pointers, across allocations. */
+
+    unsigned long offset = (img->used + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1UL);
+    if (offset + size > img->size) {
+        unsigned long new_size = img->size;
+        while (offset + size > new_size)
+            new_size <<= 1;
+        img->data = (char*)realloc(img->data,new_size);
+        if (!img->data) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        memset(&img->data[img->size],0,new_size - img->size);
+        img->size = new_size;
+    }
+    img->used = offset + size;
+    return offset;
+}
+
+static void image_pointer(struct image *img, void *field, unsigned long target) {
+    //store the offset of target in the pointer field, target 0 is NULL
+    uintptr_t *ptr = (uintptr_t*)field;
+    *ptr = target;
+    if (!target)
+        return;
+
+    if (img->reloc_next == img->reloc_size) {
+        img->reloc_size <<= 1;
+        img->reloc = (uint64_t*)realloc(img->reloc,img->reloc_size * sizeof(uint64_t));
+        if (!img->reloc) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+    }
+    img->reloc[img->reloc_next++] = IMAGE_OFFSET(img,field);
+}
+
+static unsigned long image_string(struct image *img, const char *s) {
+    if (!s)
+        return 0;
+    unsigned long size = strlen(s) + 1;
+    unsigned long offset = image_alloc(img,size);
+    memcpy(IMAGE_AT(img,offset),s,size);
+    return offset;
+}
+
+static inline unsigned long image_node(struct image *img, unsigned long nuid) {
+    return img->node_pool + nuid * sizeof(struct node);
+}
+
+static inline unsigned long image_element(struct image *img, char type,
+                                          unsigned long idx) {
+    if (type == 'v' || type == 'l')
+        return img->el_group2_pool + idx * sizeof(struct element);
+    return img->el_group1_pool + idx * sizeof(struct element);
+}
+
+static void image_cnode(struct image *img, struct container_node *_cnode) {
+    image_pointer(img,&_cnode->_node,image_node(img,_cnode->nuid));
+}
+
+static void image_cel(struct image *img, struct container_element *_cel) {
+    image_pointer(img,&_cel->_el,image_element(img,_cel->type,_cel->idx));
+}
+
+static void image_write_node(struct image *img, struct node *_node) {
+    unsigned long dst = image_node(img,_node->nuid);
+    unsigned long name = image_string(img,_node->name);
+    unsigned long attached = 0;
+    unsigned long j;
+
+    //the ground node counts its references without keeping them
+    if (_node->attached_el) {
+        attached = image_alloc(img,_node->refs * sizeof(struct container_element));
+        struct container_element *_cel =
+            (struct container_element *)IMAGE_AT(img,attached);
+        memcpy(_cel,_node->attached_el,_node->refs * sizeof(struct container_element));
+        for (j=0; j<_node->refs; ++j)
+            image_cel(img,&_cel[j]);
+    }
+
+    struct node *out = (struct node *)IMAGE_AT(img,dst);
+    *out = *_node;
+    out->el_size = _node->attached_el ? _node->refs : 0;
+    image_pointer(img,&out->name,name);
+    image_pointer(img,&out->attached_el,attached);
+}
+
+static unsigned long image_write_transient(struct image *img,
+                                           struct _transient_ *trans) {
+    if (!trans)
+        return 0;
+
+    unsigned long pair = 0;
+    unsigned long pair_size = 0;
+    if (trans->type == TR_PWL && trans->data.pwl.next) {
+        pair_size = trans->data.pwl.next * sizeof(struct transient_pwl_pair);
+        pair = image_alloc(img,pair_size);
+        memcpy(IMAGE_AT(img,pair),trans->data.pwl.pair,pair_size);
+    }
+
+    unsigned long dst = image_alloc(img,sizeof(struct _transient_));
+    struct _transient_ *out = (struct _transient_ *)IMAGE_AT(img,dst);
+    *out = *trans;
+    //set by type when the image is loaded
+    out->update.raw_ptr = NULL;
+    if (trans->type == TR_PWL) {
+        out->data.pwl.size = trans->data.pwl.next;
+        out->data.pwl.cursor = 0;
+        image_pointer(img,&out->data.pwl.pair,pair);
+    }
+    return dst;
+}
+
+static void image_write_model(struct image *img, unsigned long body,
+                              size_t offset, const char *name) {
+    unsigned long str = image_string(img,name);
+    struct nonlinear_model *model =
+        (struct nonlinear_model *)IMAGE_AT(img,body + offset);
+    image_pointer(img,&model->name,str);
+}
+
+static void image_write_element(struct image *img, struct element *_el) {
+    unsigned long dst = image_element(img,_el->type,_el->idx);
+    unsigned long name = image_string(img,_el->name);
+    unsigned long body = 0;
+
+    switch (_el->type) {
+    case 'v':
+    case 'i': {
+        unsigned long trans = image_write_transient(img,_el->_vi->transient);
+        body = image_alloc(img,sizeof(struct _source_));
+        struct _source_ *out = (struct _source_ *)IMAGE_AT(img,body);
+        *out = *_el->_vi;
+        image_cnode(img,&out->vplus);
+        image_cnode(img,&out->vminus);
+        image_pointer(img,&out->transient,trans);
+        break;
+    }
+    case 'r':
+    case 'c':
+    case 'l': {
+        body = image_alloc(img,sizeof(struct _passive_));
+        struct _passive_ *out = (struct _passive_ *)IMAGE_AT(img,body);
+        *out = *_el->_rcl;
+        image_cnode(img,&out->vplus);
+        image_cnode(img,&out->vminus);
+        break;
+    }
+    case 'm': {
+        body = image_alloc(img,sizeof(struct _mos_));
+        struct _mos_ *out = (struct _mos_ *)IMAGE_AT(img,body);
+        *out = *_el->mos;
+        image_cnode(img,&out->s);
+        image_cnode(img,&out->d);
+        image_cnode(img,&out->g);
+        image_cnode(img,&out->b);
+        image_write_model(img,body,offsetof(struct _mos_,model),
+                          _el->mos->model.name);
+        break;
+    }
+    case 'q': {
+        body = image_alloc(img,sizeof(struct _bjt_));
+        struct _bjt_ *out = (struct _bjt_ *)IMAGE_AT(img,body);
+        *out = *_el->bjt;
+        image_cnode(img,&out->c);
+        image_cnode(img,&out->e);
+        image_cnode(img,&out->b);
+        image_write_model(img,body,offsetof(struct _bjt_,model),
+                          _el->bjt->model.name);
+        break;
+    }
+    case 'd': {
+        body = image_alloc(img,sizeof(struct _diode_));
+        struct _diode_ *out = (struct _diode_ *)IMAGE_AT(img,body);
+        *out = *_el->diode;
+        image_cnode(img,&out->vplus);
+        image_cnode(img,&out->vminus);
+        image_write_model(img,body,offsetof(struct _diode_,model),
+                          _el->diode->model.name);
+        break;
+    }
+    default:
+        printf("Unknown element type '%c' - exit.\n",_el->type);
+        exit(EXIT_FAILURE);
+    }
+
+    struct element *out = (struct element *)IMAGE_AT(img,dst);
+    *out = *_el;
+    image_pointer(img,&out->name,name);
+    image_pointer(img,&out->raw_ptr,body);
+}
+
+static void image_write_command(struct image *img, unsigned long dst,
+                                struct command *cmd) {
+    unsigned long logfile = 0;
+    if (cmd->type == CMD_PRINT || cmd->type == CMD_PLOT) {
+        //open_logfiles() changes the extension in place
+        logfile = image_alloc(img,MAX_LOG_FILENAME);
+        strncpy((char*)IMAGE_AT(img,logfile),cmd->print_plot.logfile,
+                MAX_LOG_FILENAME - 1);
+    }
+
+    struct command *out = (struct command *)IMAGE_AT(img,dst);
+    *out = *cmd;
+    switch (cmd->type) {
+    case CMD_DC:
+        image_cel(img,&out->dc.source);
+        break;
+    case CMD_PRINT:
+    case CMD_PLOT: {
+        unsigned int j;
+        for (j=0; j<out->print_plot.item_num; ++j) {
+            struct cmd_print_plot_item *item = &out->print_plot.item[j];
+            if (item->type == 'v')
+                image_cnode(img,&item->cnode);
+            else
+                image_cel(img,&item->cel);
+        }
+        image_pointer(img,&out->print_plot.logfile,logfile);
+        out->print_plot.f = NULL;
+        out->print_plot.row = NULL;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void image_write_devices(struct image *img, unsigned long dst,
+                                struct device_array *dev) {
+    //one block per type, as device_array_init()
+    unsigned long size = dev->size;
+    unsigned long block =
+        image_alloc(img,size * (3 * sizeof(unsigned long) + sizeof(dfloat_t)));
+    unsigned long vplus = block;
+    unsigned long vminus = vplus + size * sizeof(unsigned long);
+    unsigned long idx = vminus + size * sizeof(unsigned long);
+    unsigned long value = idx + size * sizeof(unsigned long);
+
+    memcpy(IMAGE_AT(img,vplus),dev->vplus,size * sizeof(unsigned long));
+    memcpy(IMAGE_AT(img,vminus),dev->vminus,size * sizeof(unsigned long));
+    memcpy(IMAGE_AT(img,idx),dev->idx,size * sizeof(unsigned long));
+    memcpy(IMAGE_AT(img,value),dev->value,size * sizeof(dfloat_t));
+
+    struct device_array *out = (struct device_array *)IMAGE_AT(img,dst);
+    out->size = size;
+    image_pointer(img,&out->vplus,vplus);
+    image_pointer(img,&out->vminus,vminus);
+    image_pointer(img,&out->idx,idx);
+    image_pointer(img,&out->value,value);
+}
+
+static char *map_file(const char *filename, unsigned long *size, int writable) {
+    //NULL if the file cannot be read, the caller reports it
+    int fd = open(filename,O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    struct stat fstats;
+    if (fstat(fd,&fstats) || fstats.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    char *data = mmap(NULL,fstats.st_size,prot,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    *size = fstats.st_size;
+    return data;
+}
+
+static uint64_t source_hash(const char *filename, unsigned long *size) {
+    char *data = map_file(filename,size,0);
+    if (!data) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t hash = hash_string(data,*size);
+    munmap(data,*size);
+    return hash;
+}
+
+void netlist_compile(const char *source, struct netlist_info *netlist,
+                     const char *filename) {
+    struct image img;
+    unsigned long i;
+
+    img.size = IMAGE_INIT_SIZE;
+    img.used = 0;
+    img.data = (char*)calloc(img.size,sizeof(char));
+    img.reloc_size = RELOC_INIT_SIZE;
+    img.reloc_next = 0;
+    img.reloc = (uint64_t*)malloc(img.reloc_size * sizeof(uint64_t));
+    if (!img.data || !img.reloc) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    //the header is at offset 0, no other offset is 0
+    unsigned long header = image_alloc(&img,sizeof(struct netlist_cache_header));
+    unsigned long info = image_alloc(&img,sizeof(struct netlist_info));
+    img.node_pool = image_alloc(&img,netlist->node_size * sizeof(struct node));
+    img.el_group1_pool =
+        image_alloc(&img,netlist->el_group1_size * sizeof(struct element));
+    img.el_group2_pool =
+        image_alloc(&img,netlist->el_group2_size * sizeof(struct element));
+    unsigned long cmd_pool =
+        image_alloc(&img,netlist->cmd_pool_size * sizeof(struct command));
+
+    for (i=0; i<netlist->node_size; ++i)
+        image_write_node(&img,&netlist->node_pool[i]);
+    for (i=0; i<netlist->el_group1_size; ++i)
+        image_write_element(&img,&netlist->el_group1_pool[i]);
+    for (i=0; i<netlist->el_group2_size; ++i)
+        image_write_element(&img,&netlist->el_group2_pool[i]);
+    for (i=0; i<netlist->cmd_pool_size; ++i)
+        image_write_command(&img,cmd_pool + i * sizeof(struct command),
+                            &netlist->cmd_pool[i]);
+
+    struct netlist_info *out = (struct netlist_info *)IMAGE_AT(&img,info);
+    *out = *netlist;
+
+#define WRITE_DEVICES(t)                                                \
+    image_write_devices(&img,info + offsetof(struct netlist_info,devices.t), \
+                        &netlist->devices.t)
+    WRITE_DEVICES(r);
+    WRITE_DEVICES(c);
+    WRITE_DEVICES(l);
+    WRITE_DEVICES(v);
+    WRITE_DEVICES(i);
+#undef WRITE_DEVICES
+
+    out = (struct netlist_info *)IMAGE_AT(&img,info);
+    image_pointer(&img,&out->node_pool,img.node_pool);
+    image_pointer(&img,&out->el_group1_pool,img.el_group1_pool);
+    image_pointer(&img,&out->el_group2_pool,img.el_group2_pool);
+    image_pointer(&img,&out->cmd_pool,cmd_pool);
+
+    //the image may be used from another directory
+    unsigned long source_size;
+    uint64_t hash = source_hash(source,&source_size);
+    char *path = realpath(source,NULL);
+    unsigned long source_name = image_string(&img,path ? path : source);
+    free(path);
+
+    unsigned long reloc = image_alloc(&img,img.reloc_next * sizeof(uint64_t));
+    memcpy(IMAGE_AT(&img,reloc),img.reloc,img.reloc_next * sizeof(uint64_t));
+
+    struct netlist_cache_header *h =
+        (struct netlist_cache_header *)IMAGE_AT(&img,header);
+    memcpy(h->magic,NETLIST_CACHE_MAGIC,sizeof(h->magic));
+    h->version = NETLIST_CACHE_VERSION;
+    h->bom = NETLIST_CACHE_BOM;
+    h->sizeof_ptr = sizeof(void*);
+    h->sizeof_dfloat = sizeof(dfloat_t);
+    h->sizeof_node = sizeof(struct node);
+    h->sizeof_element = sizeof(struct element);
+    h->sizeof_command = sizeof(struct command);
+    h->image_size = img.used;
+    h->source_size = source_size;
+    h->source_hash = hash;
+    h->source_name = source_name;
+    h->netlist = info;
+    h->reloc = reloc;
+    h->reloc_size = img.reloc_next;
+
+    FILE *f = fopen(filename,"wb");
+    if (!f) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(img.data,1,img.used,f) != img.used || fclose(f)) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("compiled '%s' to '%s' (%lu bytes, %lu pointers)\n",
+           source,filename,img.used,img.reloc_next);
+
+    free(img.reloc);
+    free(img.data);
+}
+
+static int header_is_valid(struct netlist_cache_header *h, unsigned long size) {
+    return (size >= sizeof(struct netlist_cache_header) &&
+            !memcmp(h->magic,NETLIST_CACHE_MAGIC,sizeof(h->magic)) &&
+            h->version == NETLIST_CACHE_VERSION &&
+            h->bom == NETLIST_CACHE_BOM &&
+            h->sizeof_ptr == sizeof(void*) &&
+            h->sizeof_dfloat == sizeof(dfloat_t) &&
+            h->sizeof_node == sizeof(struct node) &&
+            h->sizeof_element == sizeof(struct element) &&
+            h->sizeof_command == sizeof(struct command) &&
+            h->image_size == size &&
+            h->netlist + sizeof(struct netlist_info) <= size &&
+            h->source_name < size &&
+            memchr((char*)h + h->source_name,'\0',size - h->source_name) &&
+            h->reloc <= size &&
+            h->reloc_size <= (size - h->reloc) / sizeof(uint64_t));
+}
+
+int netlist_is_compiled(const char *filename) {
+    char magic[sizeof(NETLIST_CACHE_MAGIC) - 1];
+    FILE *f = fopen(filename,"rb");
+    if (!f)
+        return 0;
+    int found = (fread(magic,1,sizeof(magic),f) == sizeof(magic) &&
+                 !memcmp(magic,NETLIST_CACHE_MAGIC,sizeof(magic)));
+    fclose(f);
+    return found;
+}
+
+static int image_is_stale(struct netlist_cache_header *h, const char *source) {
+    struct stat fstats;
+    if (stat(source,&fstats)) {
+        printf("***  WARNING  ***    source netlist '%s' not found, using the compiled netlist\n",
+               source);
+        return 0;
+    }
+
+    unsigned long size;
+    if ((unsigned long)fstats.st_size == h->source_size &&
+        source_hash(source,&size) == h->source_hash)
+        return 0;
+
+    printf("***  WARNING  ***    source netlist '%s' changed since it was compiled, parsing it again\n",
+           source);
+    return 1;
+}
+
+static void restore_transient(struct element *_el) {
+    struct _transient_ *trans = _el->_vi->transient;
+    if (!trans)
+        return;
+    switch (trans->type) {
+    case TR_EXP:    trans->update.exp = analysis_transient_call_exp;      break;
+    case TR_SIN:    trans->update.sin = analysis_transient_call_sin;      break;
+    case TR_PULSE:  trans->update.pulse = analysis_transient_call_pulse;  break;
+    case TR_PWL:    trans->update.pwl = analysis_transient_call_pwl;      break;
+    default:
+        printf("error: bad transient type in compiled netlist - exit.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void netlist_load(const char *filename, struct netlist_info *netlist) {
+    unsigned long size;
+    char *base = map_file(filename,&size,1);
+    if (!base) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    struct netlist_cache_header *h = (struct netlist_cache_header *)base;
+    if (!header_is_valid(h,size)) {
+        printf("error: '%s' is not a compiled netlist of this build - exit.\n",
+               filename);
+        exit(EXIT_FAILURE);
+    }
+
+    if (image_is_stale(h,base + h->source_name)) {
+        char *source = strdup(base + h->source_name);
+        if (!source) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        munmap(base,size);
+        parse_file(source,netlist);
+        free(source);
+        return;
+    }
+
+    //every pointer is an offset from base, in bounds
+    uint64_t *reloc = (uint64_t *)(base + h->reloc);
+    unsigned long i;
+    for (i=0; i<h->reloc_size; ++i) {
+        uint64_t field = reloc[i];
+        if (field % sizeof(uintptr_t) || field > size - sizeof(uintptr_t)) {
+            printf("error: bad relocation in compiled netlist '%s' - exit.\n",filename);
+            exit(EXIT_FAILURE);
+        }
+        uintptr_t *ptr = (uintptr_t *)(base + field);
+        if (*ptr == 0 || *ptr >= size) {
+            printf("error: bad relocation in compiled netlist '%s' - exit.\n",filename);
+            exit(EXIT_FAILURE);
+        }
+        *ptr += (uintptr_t)base;
+    }
+
+    *netlist = *(struct netlist_info *)(base + h->netlist);
+
+    //function pointers are not stored
+    for (i=0; i<netlist->el_group1_size; ++i)
+        if (netlist->el_group1_pool[i].type == 'i')
+            restore_transient(&netlist->el_group1_pool[i]);
+    for (i=0; i<netlist->el_group2_size; ++i)
+        if (netlist->el_group2_pool[i].type == 'v')
+            restore_transient(&netlist->el_group2_pool[i]);
+}
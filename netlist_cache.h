@@ -0,0 +1,49 @@
+#ifndef __NETLIST_CACHE_H__
+#define __NETLIST_CACHE_H__
+
+#include <stdint.h>
+#include "datatypes.h"
+
+/* Compiled netlist (caper --compile): the parsed pools, as one image that is
+   mapped back instead of parsing the deck again.
+
+   Every pointer in the image is stored as an offset from its beginning (0 is
+   NULL) and listed in the relocation table, the loader adds the address of
+   the mapping to each one. The names and the log file names are in a string
+   table at the end of the pools. */
+
+#define NETLIST_CACHE_MAGIC "CAPERCNL"
+#define NETLIST_CACHE_VERSION 3
+#define NETLIST_CACHE_BOM 0x01020304
+
+struct netlist_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t bom;  //byte order
+
+    //the layout of the structures the image was written with
+    uint32_t sizeof_ptr;
+    uint32_t sizeof_dfloat;
+    uint32_t sizeof_node;
+    uint32_t sizeof_element;
+    uint32_t sizeof_command;
+    uint32_t reserved;
+
+    uint64_t image_size;
+
+    //the deck the image was compiled from, to detect stale images
+    uint64_t source_size;
+    uint64_t source_hash;  //hash_string() of the contents
+    uint64_t source_name;  //absolute path, if it could be resolved
+
+    uint64_t netlist;  //struct netlist_info
+    uint64_t reloc;  //uint64_t offsets of the pointers to relocate
+    uint64_t reloc_size;
+};
+
+int netlist_is_compiled(const char *filename);
+void netlist_compile(const char *source, struct netlist_info *netlist,
+                     const char *filename);
+void netlist_load(const char *filename, struct netlist_info *netlist);
+
+#endif
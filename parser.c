@@ -13,19 +13,29 @@
 #include <ctype.h>
 #include <math.h>
 #include <float.h>
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+static inline int omp_get_max_threads() { return 1; }
+static inline int omp_get_num_threads() { return 1; }
+static inline int omp_get_thread_num() { return 0; }
+#endif
 
 #include "parser.h"
 #include "hash.h"
+#include "names.h"
 #include "transient_support.h"
 
-#define SHOULD_REBUILD 1
-#define NO_REBUILD 0
-
 void parse_line(char **buf);
 void parse_element(char **buf);
 void parse_comment(char **buf);
 void parse_command(char **buf);
 struct _transient_ *parse_transient(char **buf);
+static void parse_line_end(char **buf);
+static void index_element(struct element *_el);
+static void devices_clean();
 
 char *parse_string(char **buf, char *info);
 
@@ -64,10 +74,18 @@ static unsigned long node_pool_size = INIT_NODE_POOL_SIZE;
 static unsigned long node_pool_next = 1;
 struct node *node_pool = NULL;
 
-static unsigned int node_hash_size = 1013;
-//static unsigned int node_hash_size = 2011111;
+//initial size, the table grows with the number of nodes
+static unsigned long node_hash_size = 1024;
 struct hash_table *node_hash_table = NULL;
 
+//element names, for .dc and .print/.plot lookups
+static unsigned long el_hash_size = 1024;
+struct hash_table *el_hash_table = NULL;
+
+//every name returned by parse_string(), freed at once by parser_init()
+static unsigned long names_size = 2048;
+static struct name_table *names = NULL;
+
 static unsigned int cmd_pool_size = INIT_CMD_POOL_SIZE;
 static unsigned int cmd_pool_next = 0;
 static struct command *cmd_pool = NULL;
@@ -75,6 +93,57 @@ static struct command *cmd_pool = NULL;
 static int counter_cmd_plot = 0;
 static int counter_cmd_print = 0;
 
+//built after parsing, see build_devices()
+static struct device_table devices;
+
+/* Parallel parsing: parse_file() splits large files at line boundaries,
+   every thread parses its chunk into its own pools and tables below and
+   the chunks are merged in file order. Commands need the whole netlist,
+   they are recorded and parsed after the merge. */
+
+#ifndef PARSER_CHUNK_MIN
+#define PARSER_CHUNK_MIN (1 << 20)  //bytes per thread
+#endif
+
+struct deferred_command {
+    char *pos;
+    unsigned long line;
+};
+
+static int defer_commands = 0;
+static unsigned long deferred_size = 0;
+static unsigned long deferred_next = 0;
+static struct deferred_command *deferred_pool = NULL;
+
+//source line of every element of a chunk by euid, for chunk_merge()
+static unsigned long el_line_size = 0;
+static unsigned long *el_line = NULL;
+
+#pragma omp threadprivate(current_input,line_num,__euid__,__nuid__)
+#pragma omp threadprivate(el_group1_pool_size,el_group1_pool_next,el_group1_pool)
+#pragma omp threadprivate(el_group2_pool_size,el_group2_pool_next,el_group2_pool)
+#pragma omp threadprivate(node_pool_size,node_pool_next,node_pool)
+#pragma omp threadprivate(node_hash_table,el_hash_table,names)
+#pragma omp threadprivate(deferred_size,deferred_next,deferred_pool)
+#pragma omp threadprivate(el_line_size,el_line)
+
+//names from parse_string(), their hash is already known
+static inline struct container_node *find_node(char *name) {
+    return hash_get_hashed(node_hash_table,name,name_hash(name));
+}
+
+static inline struct container_element *find_element(char *name) {
+    return hash_get_hashed(el_hash_table,name,name_hash(name));
+}
+
+static inline struct element *get_element(char type, unsigned long idx) {
+    if (type == 'v' || type == 'l')
+        return &el_group2_pool[idx];
+    return &el_group1_pool[idx];
+}
+
+/* The parser refers to nodes and elements by nuid and pool index, the pools
+   move when they grow. rebuild() sets every pointer once, after parsing. */
 static inline void rebuild() {
     unsigned long i;
     for (i=0; i<el_group1_pool_next; ++i) {
@@ -132,28 +201,58 @@ static inline void rebuild() {
         struct node *_node = &node_pool[i];
         unsigned long j;
         for (j=0; j<_node->refs; ++j) {
-            struct element *pool = el_group1_pool;
-            if (_node->attached_el[j].type == 'v' || _node->attached_el[j].type == 'l')
-                pool = el_group2_pool;
-            _node->attached_el[j]._el = &pool[_node->attached_el[j].idx];
+            struct container_element *_cel = &_node->attached_el[j];
+            _cel->_el = get_element(_cel->type,_cel->idx);
+        }
+    }
+
+    for (i=0; i<el_hash_table->size; ++i) {
+        struct hash_element *slot = &el_hash_table->pool[i];
+        if (slot->key) {
+            struct container_element *_cel = slot->data;
+            _cel->_el = get_element(_cel->type,_cel->idx);
+        }
+    }
+
+    //commands may come before the elements and nodes they refer to
+    for (i=0; i<cmd_pool_next; ++i) {
+        struct command *cmd = &cmd_pool[i];
+        switch (cmd->type) {
+        case CMD_DC:
+            cmd->dc.source._el = get_element(cmd->dc.source.type,
+                                             cmd->dc.source.idx);
+            break;
+        case CMD_PRINT:
+        case CMD_PLOT: {
+            unsigned int j;
+            for (j=0; j<cmd->print_plot.item_num; ++j) {
+                struct cmd_print_plot_item *item = &cmd->print_plot.item[j];
+                if (item->type == 'v')
+                    item->cnode._node = &node_pool[item->cnode.nuid];
+                else
+                    item->cel._el = get_element(item->cel.type,item->cel.idx);
+            }
+            break;
+        }
+        default:
+            break;
         }
     }
 
     for (i=0; i<node_hash_table->size; ++i) {
-        struct hash_element *root = node_hash_table->pool[i];
-        while (root) {
-            struct container_node *_cnode = root->data;
+        struct hash_element *slot = &node_hash_table->pool[i];
+        if (slot->key) {
+            struct container_node *_cnode = slot->data;
             struct node **_node_ptr = &_cnode->_node;
             *_node_ptr = &node_pool[_cnode->nuid];
-            root = root->next;
         }
     }
 }
 
 static inline
 unsigned long grow(void **pool,unsigned long size, unsigned long element_size,
-          unsigned long next, const unsigned int should_rebuild) {
-    //returns the new size
+          unsigned long next) {
+    //returns the new size, pointers into the pool are not fixed (see rebuild())
 
     assert(element_size);
 
@@ -191,10 +290,7 @@ unsigned long grow(void **pool,unsigned long size, unsigned long element_size,
         exit(EXIT_FAILURE);
     }
 
-    void *old_pool = *pool;
     *pool = new_pool;
-    if (old_pool != new_pool && should_rebuild)
-        rebuild();
 
     return new_size;
 }
@@ -220,7 +316,6 @@ static inline struct container_node parse_node(char **buf, struct element *el,
     //do not track ground node
     struct node *ground = &node_pool[0];
     if (strcmp(ground->name,name) == 0) {
-        free(name);
         ground->refs++;
         struct container_node container = { .nuid=ground->nuid, ._node=ground };
         return container;
@@ -229,14 +324,12 @@ static inline struct container_node parse_node(char **buf, struct element *el,
     struct node *_node = NULL;
     struct container_node *_cnode = NULL;
 
-    _cnode = hash_get(node_hash_table,name);
+    _cnode = find_node(name);
     if (_cnode) {
-        _node = _cnode->_node;
+        _node = &node_pool[_cnode->nuid];
         assert(_node->nuid != 0);
-        free(name);
         _node->el_size = grow((void**)&_node->attached_el,_node->el_size,
-                              sizeof(struct container_element),_node->refs,
-                              NO_REBUILD);
+                              sizeof(struct container_element),_node->refs);
         _node->attached_el[_node->refs].type = el->type;
         _node->attached_el[_node->refs].idx = el->idx;
         _node->attached_el[_node->refs]._el = el;
@@ -248,7 +341,7 @@ static inline struct container_node parse_node(char **buf, struct element *el,
 
     /* check if we need to resize the pool */
     node_pool_size = grow((void**)&node_pool,node_pool_size,
-                          sizeof(struct node),node_pool_next,SHOULD_REBUILD);
+                          sizeof(struct node),node_pool_next);
 
     unsigned long _nuid = __nuid__++;
     _node = &node_pool[node_pool_next++];
@@ -261,7 +354,7 @@ static inline struct container_node parse_node(char **buf, struct element *el,
     _cnode->nuid = _nuid;
     _cnode->_node = _node;
 
-    hash_insert(node_hash_table,name,_cnode);
+    hash_insert_hashed(node_hash_table,name,name_hash(name),_cnode);
 
     _node->nuid = _nuid;
     _node->name = name;
@@ -271,8 +364,7 @@ static inline struct container_node parse_node(char **buf, struct element *el,
     _node->attached_el = NULL;
 
     _node->el_size = grow((void**)&_node->attached_el,_node->el_size,
-                          sizeof(struct container_element),_node->refs,
-                          NO_REBUILD);
+                          sizeof(struct container_element),_node->refs);
     _node->attached_el[_node->refs].type = el->type;
     _node->attached_el[_node->refs].idx = el->idx;
     _node->attached_el[_node->refs]._el = el;
@@ -282,7 +374,7 @@ static inline struct container_node parse_node(char **buf, struct element *el,
     return container;
 }
 
-static inline struct element *get_new_element(char type) {
+static inline struct element *get_pool_slot(char type) {
     /* check if we need to resize the pool */
 
     struct element *el = NULL;
@@ -292,15 +384,13 @@ static inline struct element *get_new_element(char type) {
     case 'v':
     case 'l':
         el_group2_pool_size = grow((void**)&el_group2_pool,el_group2_pool_size,
-                                   sizeof(struct element),el_group2_pool_next,
-                                   SHOULD_REBUILD);
+                                   sizeof(struct element),el_group2_pool_next);
         el = &el_group2_pool[el_group2_pool_next];
         idx = el_group2_pool_next++;
         break;
     default:
         el_group1_pool_size = grow((void**)&el_group1_pool,el_group1_pool_size,
-                                   sizeof(struct element),el_group1_pool_next,
-                                   SHOULD_REBUILD);
+                                   sizeof(struct element),el_group1_pool_next);
         el = &el_group1_pool[el_group1_pool_next];
         idx = el_group1_pool_next++;
     }
@@ -308,6 +398,11 @@ static inline struct element *get_new_element(char type) {
     assert(el);
     el->type = type;
     el->idx = idx;
+    return el;
+}
+
+static inline struct element *get_new_element(char type) {
+    struct element *el = get_pool_slot(type);
     el->euid = __euid__++;
     el->name = NULL;  //we get the name later
 
@@ -408,43 +503,36 @@ void print_nodes(unsigned long size, struct node node_pool[size]) {
         print_node(&node_pool[i]);
 }
 
-void parser_init() {
+static void parser_init_pools() {
     line_num = 1;
 
     if (el_group1_pool) {
-        unsigned long i;
-        for (i=0; i<el_group1_pool_next; ++i) {
-            struct element *_el = &el_group1_pool[i];
-            free(_el->name);
-        }
         free(el_group1_pool);
         el_group1_pool = NULL;
     }
 
     if (el_group2_pool) {
-        unsigned long i;
-        for (i=0; i<el_group2_pool_next; ++i) {
-            struct element *_el = &el_group2_pool[i];
-            free(_el->name);
-        }
         free(el_group2_pool);
         el_group2_pool = NULL;
     }
 
     if (node_pool) {
-        unsigned long i;
-        for (i=1; i<node_pool_next; ++i) {
-            struct node *_n = &node_pool[i];
-            free(_n->name);
-        }
         free(node_pool);
         node_pool = NULL;
     }
 
+    if (names)
+        names_clean_table(names);
+    names = names_create_table(names_size);
+
     if (node_hash_table)
         hash_clean_table(node_hash_table);
     node_hash_table = hash_create_table(node_hash_size);
 
+    if (el_hash_table)
+        hash_clean_table(el_hash_table);
+    el_hash_table = hash_create_table(el_hash_size);
+
     __euid__ = 0;
 
     el_group1_pool_size = INIT_EL_POOL_SIZE;
@@ -493,6 +581,15 @@ void parser_init() {
     _cground->_node = ground;
     hash_insert(node_hash_table,ground->name,_cground);
 
+    deferred_size = 0;
+    deferred_next = 0;
+    deferred_pool = NULL;
+}
+
+void parser_init() {
+    parser_init_pools();
+    devices_clean();
+
     cmd_pool_size = INIT_CMD_POOL_SIZE;
     cmd_pool_next = 0;
 
@@ -574,14 +671,387 @@ void close_file(struct file_info **finfo) {
     *finfo = NULL;
 }
 
+struct parser_chunk {
+    struct file_info input;
+    unsigned long lines;  //newlines in the chunk
+
+    //state of the thread that parsed the chunk
+    unsigned long euid;
+    unsigned long el_group1_pool_next;
+    struct element *el_group1_pool;
+    unsigned long el_group2_pool_next;
+    struct element *el_group2_pool;
+    unsigned long node_pool_next;
+    struct node *node_pool;
+    unsigned long deferred_next;
+    struct deferred_command *deferred_pool;
+    unsigned long *el_line;
+    struct name_table *names;
+};
+
+static void chunk_split(struct file_info *input, int size,
+                        struct parser_chunk chunk[size]) {
+    //every chunk begins at the start of a line
+    char *begin = input->raw_begin;
+    int i;
+    for (i=0; i<size; ++i) {
+        char *end = input->raw_end;
+        if (i < size - 1) {
+            char *split = input->raw_begin + input->size / size * (i + 1);
+            if (split < begin)
+                split = begin;
+            char *newline = memchr(split,'\n',input->raw_end - split);
+            if (newline)
+                end = newline + 1;
+        }
+        chunk[i].input = *input;
+        chunk[i].input.raw_begin = begin;
+        chunk[i].input.raw_end = end;
+        chunk[i].input.size = end - begin;
+        begin = end;
+    }
+}
+
+static unsigned long count_lines(char *begin, char *end) {
+    unsigned long lines = 0;
+    while ((begin = memchr(begin,'\n',end - begin))) {
+        lines++;
+        begin++;
+    }
+    return lines;
+}
+
+static void chunk_save(struct parser_chunk *chunk) {
+    //move the pools of the thread to the chunk, the tables are rebuilt
+    //by chunk_merge()
+    chunk->euid = __euid__;
+    chunk->el_group1_pool_next = el_group1_pool_next;
+    chunk->el_group1_pool = el_group1_pool;
+    chunk->el_group2_pool_next = el_group2_pool_next;
+    chunk->el_group2_pool = el_group2_pool;
+    chunk->node_pool_next = node_pool_next;
+    chunk->node_pool = node_pool;
+    chunk->names = names;
+
+    hash_clean_table(node_hash_table);
+    hash_clean_table(el_hash_table);
+    el_group1_pool = NULL;
+    el_group2_pool = NULL;
+    node_pool = NULL;
+    node_hash_table = NULL;
+    el_hash_table = NULL;
+    names = NULL;
+}
+
+static inline void remap_node(struct container_node *_cnode,
+                              const unsigned long *nuid_map) {
+    _cnode->nuid = nuid_map[_cnode->nuid];
+}
+
+static void remap_element(struct element *_el, const unsigned long *nuid_map) {
+    switch (_el->type) {
+    case 'v':
+    case 'i':
+        remap_node(&_el->_vi->vplus,nuid_map);
+        remap_node(&_el->_vi->vminus,nuid_map);
+        break;
+    case 'r':
+    case 'c':
+    case 'l':
+        remap_node(&_el->_rcl->vplus,nuid_map);
+        remap_node(&_el->_rcl->vminus,nuid_map);
+        break;
+    case 'q':
+        remap_node(&_el->bjt->c,nuid_map);
+        remap_node(&_el->bjt->e,nuid_map);
+        remap_node(&_el->bjt->b,nuid_map);
+        break;
+    case 'm':
+        remap_node(&_el->mos->s,nuid_map);
+        remap_node(&_el->mos->d,nuid_map);
+        remap_node(&_el->mos->g,nuid_map);
+        remap_node(&_el->mos->b,nuid_map);
+        break;
+    case 'd':
+        remap_node(&_el->diode->vplus,nuid_map);
+        remap_node(&_el->diode->vminus,nuid_map);
+        break;
+    default:
+        printf("Unknown element type '%c' in chunk - exit.\n",_el->type);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void merge_elements(struct element *pool, unsigned long size,
+                           unsigned long euid_base,
+                           const unsigned long *nuid_map,
+                           const unsigned long *el_line) {
+    unsigned long i;
+    for (i=0; i<size; ++i) {
+        unsigned long line = el_line[pool[i].euid];
+        struct element *_el = get_pool_slot(pool[i].type);
+        unsigned long idx = _el->idx;
+        *_el = pool[i];
+        _el->idx = idx;
+        _el->euid += euid_base;
+        remap_element(_el,nuid_map);
+
+        if (find_element(_el->name)) {
+            printf("error:%lu: element '%s' already exists - exit.\n",
+                   line,_el->name);
+            exit(EXIT_FAILURE);
+        }
+        index_element(_el);
+    }
+}
+
+static void chunk_merge(struct parser_chunk *chunk) {
+    /* Append the chunk to the pools of this thread, in the same order as the
+       serial parser: nodes first seen in the chunk get the next nuids in
+       their order of appearance, elements keep their order in each pool.
+       Pointers are set by the rebuild() at the end of parse_file(). */
+
+    unsigned long group1_base = el_group1_pool_next;
+    unsigned long group2_base = el_group2_pool_next;
+    unsigned long i;
+
+    unsigned long *nuid_map =
+        (unsigned long*)malloc(chunk->node_pool_next * sizeof(unsigned long));
+    if (!nuid_map) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    //ground node
+    nuid_map[0] = 0;
+    node_pool[0].refs += chunk->node_pool[0].refs;
+
+    for (i=1; i<chunk->node_pool_next; ++i) {
+        struct node *_cn = &chunk->node_pool[i];
+        unsigned long j;
+        for (j=0; j<_cn->refs; ++j) {
+            struct container_element *_cel = &_cn->attached_el[j];
+            if (_cel->type == 'v' || _cel->type == 'l')
+                _cel->idx += group2_base;
+            else
+                _cel->idx += group1_base;
+        }
+
+        struct container_node *_cnode = find_node(_cn->name);
+        if (_cnode) {
+            struct node *_node = &node_pool[_cnode->nuid];
+            for (j=0; j<_cn->refs; ++j) {
+                _node->el_size = grow((void**)&_node->attached_el,_node->el_size,
+                                      sizeof(struct container_element),
+                                      _node->refs);
+                _node->attached_el[_node->refs++] = _cn->attached_el[j];
+            }
+            nuid_map[i] = _cnode->nuid;
+            free(_cn->attached_el);
+            continue;
+        }
+
+        node_pool_size = grow((void**)&node_pool,node_pool_size,
+                              sizeof(struct node),node_pool_next);
+        unsigned long _nuid = __nuid__++;
+        struct node *_node = &node_pool[node_pool_next++];
+        *_node = *_cn;
+        _node->nuid = _nuid;
+
+        _cnode = (struct container_node*)malloc(sizeof(struct container_node));
+        if (!_cnode) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        _cnode->nuid = _nuid;
+        _cnode->_node = _node;
+        hash_insert_hashed(node_hash_table,_node->name,name_hash(_node->name),_cnode);
+        nuid_map[i] = _nuid;
+    }
+
+    unsigned long euid_base = __euid__;
+    merge_elements(chunk->el_group1_pool,chunk->el_group1_pool_next,
+                   euid_base,nuid_map,chunk->el_line);
+    merge_elements(chunk->el_group2_pool,chunk->el_group2_pool_next,
+                   euid_base,nuid_map,chunk->el_line);
+    __euid__ = euid_base + chunk->euid;
+
+    //names of the chunk are still in use
+    names_move(names,chunk->names);
+
+    free(nuid_map);
+    free(chunk->node_pool);
+    free(chunk->el_group1_pool);
+    free(chunk->el_group2_pool);
+}
+
+static void parse_chunks(int threads) {
+    struct file_info *input = current_input;
+    struct parser_chunk *chunk =
+        (struct parser_chunk*)malloc(threads * sizeof(struct parser_chunk));
+    if (!chunk) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    int size = 0;
+    defer_commands = 1;
+
+#pragma omp parallel num_threads(threads)
+    {
+        int t = omp_get_thread_num();
+
+#pragma omp single
+        {
+            size = omp_get_num_threads();
+            chunk_split(input,size,chunk);
+        }
+
+        chunk[t].lines = count_lines(chunk[t].input.raw_begin,
+                                     chunk[t].input.raw_end);
+#pragma omp barrier
+
+        //the first thread keeps its pools, the others are merged into them
+        if (t)
+            parser_init_pools();
+        current_input = &chunk[t].input;
+        line_num = 1;
+        int i;
+        for (i=0; i<t; ++i)
+            line_num += chunk[i].lines;
+
+        char *ptr;
+        for (ptr = current_input->raw_begin; ptr; )
+            parse_line(&ptr);
+
+        if (t)
+            chunk_save(&chunk[t]);
+        chunk[t].deferred_next = deferred_next;
+        chunk[t].deferred_pool = deferred_pool;
+        chunk[t].el_line = el_line;
+        deferred_pool = NULL;
+        el_line = NULL;
+        el_line_size = 0;
+        current_input = NULL;
+    }
+
+    current_input = input;
+    defer_commands = 0;
+
+    int i;
+    for (i=1; i<size; ++i)
+        chunk_merge(&chunk[i]);
+
+    for (i=0; i<size; ++i) {
+        unsigned long j;
+        for (j=0; j<chunk[i].deferred_next; ++j) {
+            char *ptr = chunk[i].deferred_pool[j].pos;
+            line_num = chunk[i].deferred_pool[j].line;
+            parse_command(&ptr);
+            parse_line_end(&ptr);
+        }
+        free(chunk[i].deferred_pool);
+        free(chunk[i].el_line);
+    }
+    free(chunk);
+}
+
+static void device_array_init(struct device_array *dev, unsigned long size) {
+    //one block per type
+    dev->size = 0;
+    unsigned long bytes = size * (3 * sizeof(unsigned long) + sizeof(dfloat_t));
+    dev->vplus = (unsigned long*)malloc(bytes);
+    if (!dev->vplus && bytes) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    dev->vminus = &dev->vplus[size];
+    dev->idx = &dev->vminus[size];
+    dev->value = (dfloat_t*)&dev->idx[size];
+}
+
+static void device_array_add(struct device_array *dev, struct element *_el,
+                             struct container_node *vplus,
+                             struct container_node *vminus, dfloat_t value) {
+    unsigned long k = dev->size++;
+    dev->vplus[k] = vplus->nuid;
+    dev->vminus[k] = vminus->nuid;
+    dev->idx[k] = _el->idx;
+    dev->value[k] = value;
+}
+
+static void devices_clean() {
+    free(devices.r.vplus);
+    free(devices.c.vplus);
+    free(devices.l.vplus);
+    free(devices.v.vplus);
+    free(devices.i.vplus);
+    memset(&devices,0,sizeof(devices));
+}
+
+static void build_devices() {
+    unsigned long size[128] = { 0 };
+    unsigned long i;
+
+    for (i=0; i<el_group1_pool_next; ++i)
+        size[(int)el_group1_pool[i].type]++;
+    for (i=0; i<el_group2_pool_next; ++i)
+        size[(int)el_group2_pool[i].type]++;
+
+    device_array_init(&devices.r,size['r']);
+    device_array_init(&devices.c,size['c']);
+    device_array_init(&devices.l,size['l']);
+    device_array_init(&devices.v,size['v']);
+    device_array_init(&devices.i,size['i']);
+
+    for (i=0; i<el_group1_pool_next; ++i) {
+        struct element *_el = &el_group1_pool[i];
+        switch (_el->type) {
+        case 'r':
+            device_array_add(&devices.r,_el,&_el->r->vplus,&_el->r->vminus,
+                             1/_el->value);
+            break;
+        case 'c':
+            device_array_add(&devices.c,_el,&_el->c->vplus,&_el->c->vminus,
+                             _el->value);
+            break;
+        case 'i':
+            device_array_add(&devices.i,_el,&_el->i->vplus,&_el->i->vminus,
+                             _el->value);
+            break;
+        default:  break;
+        }
+    }
+
+    for (i=0; i<el_group2_pool_next; ++i) {
+        struct element *_el = &el_group2_pool[i];
+        if (_el->type == 'v')
+            device_array_add(&devices.v,_el,&_el->v->vplus,&_el->v->vminus,
+                             _el->value);
+        else
+            device_array_add(&devices.l,_el,&_el->l->vplus,&_el->l->vminus,
+                             _el->value);
+    }
+}
+
 void parse_file(const char *filename, struct netlist_info *netlist) {
     parser_init();
     assert(!current_input);
     current_input = open_file(filename);
 
-    char *ptr;
-    for (ptr = current_input->raw_begin; ptr; )
-        parse_line(&ptr);
+    unsigned long threads = omp_get_max_threads();
+    if (threads > current_input->size / PARSER_CHUNK_MIN)
+        threads = current_input->size / PARSER_CHUNK_MIN;
+
+    if (threads > 1)
+        parse_chunks(threads);
+    else {
+        char *ptr;
+        for (ptr = current_input->raw_begin; ptr; )
+            parse_line(&ptr);
+    }
+    rebuild();
+    build_devices();
 
     close_file(&current_input);
 
@@ -596,6 +1066,7 @@ void parse_file(const char *filename, struct netlist_info *netlist) {
     netlist->el_group2_pool = el_group2_pool;
     netlist->cmd_pool_size = cmd_pool_next;
     netlist->cmd_pool = cmd_pool;
+    netlist->devices = devices;
 }
 
 void parse_eat_whitechars(char **buf) {
@@ -649,6 +1120,22 @@ static int discard_line(char **buf) {
     return bad_chars;
 }
 
+static void parse_line_end(char **buf) {
+    int garbage = discard_line(buf);
+    if (garbage) {
+        printf("warning: %d garbage characters at end of line %lu\n", garbage, line_num);
+        //exit(EXIT_FAILURE);
+    }
+}
+
+static void defer_command(char *pos) {
+    deferred_size = grow((void**)&deferred_pool,deferred_size,
+                         sizeof(struct deferred_command),deferred_next);
+    deferred_pool[deferred_next].pos = pos;
+    deferred_pool[deferred_next].line = line_num;
+    deferred_next++;
+}
+
 void parse_line(char **buf) {
     parse_eat_whitechars(buf);
     if (!*buf)
@@ -658,15 +1145,19 @@ void parse_line(char **buf) {
         return;
     switch (**buf) {
     case '*':  parse_comment(buf);  break;
-    case '.':  parse_command(buf);  break;
+    case '.':
+        if (defer_commands) {
+            defer_command(*buf);
+            parse_comment(buf);
+            return;
+        }
+        parse_command(buf);
+        break;
     default:   parse_element(buf);  break;
     }
-    int garbage = discard_line(buf);
-    if (garbage) {
-        printf("warning: %d garbage characters at end of line %lu\n", garbage, line_num);
-        //exit(EXIT_FAILURE);
-    }
-    if (line_num % 512 == 0)
+    parse_line_end(buf);
+    //one progress report, from the first chunk
+    if (line_num % 512 == 0 && omp_get_thread_num() == 0)
         printf("line: %8lu\n",line_num);
 }
 
@@ -741,18 +1232,8 @@ char *parse_string(char **buf, char *info) {
         size++;
     }
 
-    char *name = (char*)malloc((size+1) * sizeof(char));
-    if (!name) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-    name = strncpy(name,start,size);
-    name[size] = '\0';
-
-    //convert to lowercase
-    int i;
-    for (i=0; i<size; ++i)
-        name[i] = tolower(name[i]);
+    //lowercase, do not free()
+    char *name = names_intern(names,start,size);
 
     //printf("debug: new string : %s\n",name);
 
@@ -800,6 +1281,135 @@ char parse_char(char **buf, char *patterns, char *info) {
     return c;
 }
 
+//exact powers of ten, for the fast path of parse_number()
+static const double pow10_table[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAX_NUMBER_SIZE 64
+#define MAX_EXPONENT 100000
+
+static inline int match_suffix(char *p, char *end, const char *suffix) {
+    while (*suffix) {
+        if (p == end || tolower(*p) != *suffix)
+            return 0;
+        p++;
+        suffix++;
+    }
+    return 1;
+}
+
+static int parse_number(char **buf, char *end, double *value) {
+    /* [+-]digits[.digits][e[+-]digits][suffix][unit]
+
+       Reads at most up to end and allocates nothing. The SPICE suffixes
+       (t g meg k mil m u n p f) go to the decimal exponent, the letters of
+       a unit after them ("10uF", "1kohm") are ignored. Returns 0 if there
+       is no number at *buf. */
+
+    char *p = *buf;
+    char *mantissa_begin = p;
+
+    int negative = 0;
+    if (p != end && (*p == '+' || *p == '-')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    //up to 19 significant digits, then only the exponent counts
+    uint64_t mantissa = 0;
+    int exp10 = 0;
+    int digits = 0;
+    int truncated = 0;
+
+    for (; p != end && isdigit(*p); ++p, ++digits) {
+        if (mantissa < UINT64_C(1000000000000000000))
+            mantissa = mantissa * 10 + (*p - '0');
+        else {
+            exp10++;
+            truncated |= (*p != '0');
+        }
+    }
+    if (p != end && *p == '.') {
+        for (p++; p != end && isdigit(*p); ++p, ++digits) {
+            if (mantissa < UINT64_C(1000000000000000000)) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exp10--;
+            }
+            else
+                truncated |= (*p != '0');
+        }
+    }
+    if (!digits)
+        return 0;
+    char *mantissa_end = p;
+
+    int exponent = 0;
+    if (p != end && tolower(*p) == 'e') {
+        char *q = p + 1;
+        int exp_negative = 0;
+        if (q != end && (*q == '+' || *q == '-')) {
+            exp_negative = (*q == '-');
+            q++;
+        }
+        if (q != end && isdigit(*q)) {
+            for (; q != end && isdigit(*q); ++q)
+                if (exponent < MAX_EXPONENT)
+                    exponent = exponent * 10 + (*q - '0');
+            if (exp_negative)
+                exponent = -exponent;
+            p = q;
+        }
+    }
+
+    double scale = 1;
+    if (match_suffix(p,end,"meg"))
+        exponent += 6;
+    else if (match_suffix(p,end,"mil"))
+        scale = 25.4e-6;
+    else if (p != end)
+        switch (tolower(*p)) {
+        case 't':  exponent += 12;  break;
+        case 'g':  exponent += 9;   break;
+        case 'k':  exponent += 3;   break;
+        case 'm':  exponent -= 3;   break;
+        case 'u':  exponent -= 6;   break;
+        case 'n':  exponent -= 9;   break;
+        case 'p':  exponent -= 12;  break;
+        case 'f':  exponent -= 15;  break;
+        }
+    while (p != end && isalpha(*p))
+        p++;
+
+    exp10 += exponent;
+    if (!truncated && mantissa < (UINT64_C(1) << 53) &&
+        exp10 >= -22 && exp10 <= 22) {
+        //exact operands, one rounding
+        double v = (double)mantissa;
+        if (exp10 < 0)
+            v /= pow10_table[-exp10];
+        else
+            v *= pow10_table[exp10];
+        *value = (negative ? -v : v) * scale;
+    }
+    else {
+        //long mantissa or large exponent, let strtod() round it
+        char number[MAX_NUMBER_SIZE + 16];
+        int size = mantissa_end - mantissa_begin;
+        if (size > MAX_NUMBER_SIZE) {
+            printf("error:%lu: number too long - exit.\n",line_num);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(number,mantissa_begin,size);
+        sprintf(&number[size],"e%d",exponent);
+        *value = strtod(number,NULL) * scale;
+    }
+
+    *buf = p;
+    return 1;
+}
+
 dfloat_t parse_value(char **buf, char *prefix, char *info) {
     //printf("in function: %s\n",__FUNCTION__);
 
@@ -808,13 +1418,13 @@ dfloat_t parse_value(char **buf, char *prefix, char *info) {
         exit(EXIT_FAILURE);
     }
 
+    char *end = current_input->raw_end;
+
     if (prefix) {
         int i;
         int size = strlen(prefix);
         for (i=0; i<size; ++i) {
-            char c = tolower(**buf);
-            char p = tolower(prefix[i]);
-            if (c != p) {
+            if (*buf == end || tolower(**buf) != tolower(prefix[i])) {
                 printf("error:%lu: expected prefix '%s' before value - exit\n",
                        line_num,prefix);
                 exit(EXIT_FAILURE);
@@ -823,31 +1433,18 @@ dfloat_t parse_value(char **buf, char *prefix, char *info) {
         }
     }
 
-    char *end = current_input->raw_end;
     errno = 0;
 
-    dfloat_t value;
-    int offset = 0;
-#ifdef PRECISION_DOUBLE
-    int status = sscanf(*buf,"%lf%n",&value,&offset);
-#else
-    int status = sscanf(*buf,"%f%n",&value,&offset);
-#endif
-    if (errno) {
-        perror(__FUNCTION__);
-        exit(EXIT_FAILURE);
-    }
-    if (status == EOF) {
-        printf("error: sscanf() early fail\n");
+    double number;
+    if (!parse_number(buf,end,&number)) {
+        printf("error:%lu: expected %s, bad number - exit.\n",line_num,info);
         exit(EXIT_FAILURE);
     }
-    if (status == 0) {
-        printf("error: sscanf() bad input '%10s'\n",*buf);
+    if (errno) {
+        perror(__FUNCTION__);
         exit(EXIT_FAILURE);
     }
-
-    assert(offset);
-    *buf += offset;
+    dfloat_t value = number;
 
     if (*buf == end)
         *buf = NULL;
@@ -917,6 +1514,19 @@ static void check_transient(struct element *el) {
     }
 }
 
+static void index_element(struct element *_el) {
+    struct container_element *_cel =
+        (struct container_element*)malloc(sizeof(struct container_element));
+    if (!_cel) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    _cel->type = _el->type;
+    _cel->idx = _el->idx;
+    _cel->_el = _el;
+    hash_insert_hashed(el_hash_table,_el->name,name_hash(_el->name),_cel);
+}
+
 void parse_element(char **buf) {
     //printf("in function: %s\n",__FUNCTION__);
 
@@ -977,6 +1587,18 @@ void parse_element(char **buf) {
         printf("Unknown element type '%c' - exit.\n",type);
         exit(EXIT_FAILURE);
     }
+
+    if (find_element(s_el->name)) {
+        printf("error:%lu: element '%s' already exists - exit.\n",
+               line_num,s_el->name);
+        exit(EXIT_FAILURE);
+    }
+    if (defer_commands) {
+        el_line_size = grow((void**)&el_line,el_line_size,
+                            sizeof(unsigned long),s_el->euid);
+        el_line[s_el->euid] = line_num;
+    }
+    index_element(s_el);
 }
 
 //these must be in the same order as in the enum transient_type in datatypes.h
@@ -1006,7 +1628,6 @@ struct _transient_ *parse_transient(char **buf) {
     }
     char *str_trans = parse_string(buf,"transient type");
     trans->type = get_transient_type(str_trans);
-    free(str_trans);
 
     switch (trans->type) {
     case TR_EXP:
@@ -1071,6 +1692,7 @@ struct _transient_ *parse_transient(char **buf) {
         trans->update.pwl = analysis_transient_call_pwl;
         trans->data.pwl.size = default_pair_size;
         trans->data.pwl.next = 0;
+        trans->data.pwl.cursor = 0;
         trans->data.pwl.pair =
             (struct transient_pwl_pair *)calloc(default_pair_size,
                                                 sizeof(struct transient_pwl_pair));
@@ -1086,10 +1708,17 @@ struct _transient_ *parse_transient(char **buf) {
                 parse_value(buf,NULL,"pwl pair (time field)");
             trans->data.pwl.pair[trans->data.pwl.next].value =
                 parse_value(buf,NULL,"pwl pair (value field)");
+            //the lookup in analysis_transient_call_pwl() needs sorted times
+            if (trans->data.pwl.next &&
+                trans->data.pwl.pair[trans->data.pwl.next].time <
+                trans->data.pwl.pair[trans->data.pwl.next - 1].time) {
+                printf("error:%lu: pwl times must not decrease - exit.\n",line_num);
+                exit(EXIT_FAILURE);
+            }
             trans->data.pwl.next++;
-            grow((void **)&trans->data.pwl.pair,trans->data.pwl.size,
-                 sizeof(struct transient_pwl_pair),trans->data.pwl.next,
-                 NO_REBUILD);
+            trans->data.pwl.size =
+                grow((void **)&trans->data.pwl.pair,trans->data.pwl.size,
+                     sizeof(struct transient_pwl_pair),trans->data.pwl.next);
             parse_char(buf,")","')' rparen");
             parse_eat_whitechars(buf);
         }
@@ -1117,7 +1746,9 @@ void parse_comment(char **buf) {
 static const char *cmd_base[] = { "option", "dc", "plot", "print", "tran" };
 
 //these must be in the same order as in the enum cmd_opt_type in datatypes.h
-static const char *cmd_opt_base[] = { "spd", "iter", "itol", "sparse", "tr", "be" };
+static const char *cmd_opt_base[] = { "spd", "iter", "itol", "sparse", "tr", "be",
+                                      "adaptive", "reltol", "abstol", "binary",
+                                      "dense", "membudget", "rcm" };
 
 static inline enum cmd_type get_cmd_type(char *cmd) {
     assert(cmd);
@@ -1174,7 +1805,6 @@ void parse_print_plot_item(char **buf, struct command *cmd) {
             printf("error:%lu: expected literal string 'tran' - exit\n",line_num);
             exit(EXIT_FAILURE);
         }
-        free(tmp);
         //read the real el_type
         el_type = parse_char(buf,"vi","print/plot type");
     }
@@ -1185,10 +1815,9 @@ void parse_print_plot_item(char **buf, struct command *cmd) {
 
     char *node_name = parse_string(buf,"node name");
     if (el_type == 'v') {
-        struct container_node *_cnode = hash_get(node_hash_table,node_name);
+        struct container_node *_cnode = find_node(node_name);
         if (!_cnode) {
             printf("error: node '%s' not found - exit\n",node_name);
-            free(node_name);
             exit(EXIT_FAILURE);
         }
 
@@ -1196,27 +1825,20 @@ void parse_print_plot_item(char **buf, struct command *cmd) {
         cmd->print_plot.item[idx].cnode =*_cnode;
     }
     else {
-        //TODO: we need hash tables for elements for faster searches
-        unsigned int i;
-        struct element *_el = NULL;
-        for (i=0; i<el_group1_pool_next; ++i) {
-            struct element *el = &el_group1_pool[i];
-            if (el->type == 'i' && strcmp(el->name,node_name) == 0) {
-                _el = el;
-                break;
-            }
-        }
-        if (!_el) {
+        //branch currents only, they are part of the solution
+        struct container_element *_cel = find_element(node_name);
+        if (!_cel) {
             printf("error: element '%s' not found - exit\n",node_name);
-            free(node_name);
+            exit(EXIT_FAILURE);
+        }
+        if (_cel->type != 'v' && _cel->type != 'l') {
+            printf("error:%lu: no branch current for element '%s', expected voltage source or inductor - exit\n",
+                   line_num,node_name);
             exit(EXIT_FAILURE);
         }
 
         cmd->print_plot.item[idx].type = el_type;
-        struct container_element _cel = { .type=_el->type,
-                                          .idx=_el->idx,
-                                          ._el=_el };
-        cmd->print_plot.item[idx].cel =_cel;
+        cmd->print_plot.item[idx].cel =*_cel;
     }
 
     cmd->print_plot.item_num++;
@@ -1232,13 +1854,11 @@ static enum cmd_option_type parse_option(char **buf) {
     char *option = parse_string(buf,"option");
 
     if (!strcmp(option,"method=")) {
-        free(option);
         option = parse_string(buf,"transient method");
     }
     else if (!strcmp(option,"method")) {
         parse_char(buf,"=","'=' asignment");
         parse_eat_whitechars(buf);
-        free(option);
         option = parse_string(buf,"transient method");
     }
 
@@ -1247,10 +1867,29 @@ static enum cmd_option_type parse_option(char **buf) {
         printf("***  WARNING  ***    Unknown .option argument '%s' - error\n",option);
         *buf = backup_pos;
     }
-    free(option);
     return type;
 }
 
+static inline int option_has_value(enum cmd_option_type type) {
+    switch (type) {
+    case CMD_OPT_ITOL:
+    case CMD_OPT_RELTOL:
+    case CMD_OPT_ABSTOL:
+    case CMD_OPT_MEMBUDGET:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static dfloat_t parse_option_value(char **buf) {
+    //accept both 'opt=<value>' and 'opt <value>'
+    parse_eat_whitechars(buf);
+    parse_char(buf,"=",NULL);
+    parse_eat_whitechars(buf);
+    return parse_value(buf,NULL,"option value");
+}
+
 void parse_command(char **buf) {
     //printf("in function: %s\n",__FUNCTION__);
 
@@ -1262,7 +1901,6 @@ void parse_command(char **buf) {
 
     if (type == CMD_BAD_COMMAND) {
         printf("***  WARNING  ***    Unknown command '%s'\n",cmd);
-        free(cmd);
         return;
     }
 
@@ -1277,37 +1915,19 @@ void parse_command(char **buf) {
             new_cmd.option[type] = 1;
             if (new_cmd.option[CMD_OPT_BAD_OPTION])
                 return;
+            if (option_has_value(type))
+                new_cmd.option_value[type] = parse_option_value(buf);
         } while (*buf && !isdelimiter(**buf));
         break;
     }
     case CMD_DC: {
         char *name = parse_string(buf,"dc source");
-        unsigned long i;
-
-        char dc_type = name[0];
-        assert(dc_type == 'v' || dc_type == 'i');
-
-        struct element *dc_source = NULL;
-        if (dc_type == 'v')
-            for (i=0; i<el_group2_pool_next; ++i) {
-                struct element *el = &el_group2_pool[i];
-                if (el->type == 'v' && strcmp(el->name,name) == 0) {
-                    dc_source = el;
-                    break;
-                }
-            }
-        else
-            for (i=0; i<el_group1_pool_next; ++i) {
-                struct element *el = &el_group1_pool[i];
-                if (el->type == 'i' && strcmp(el->name,name) == 0) {
-                    dc_source = el;
-                    break;
-                }
-            }
 
+        struct container_element *dc_source = find_element(name);
+        if (dc_source && dc_source->type != 'v' && dc_source->type != 'i')
+            dc_source = NULL;
         if (!dc_source) {
             printf("***  WARNING  ***    Unknown dc source '%s' - error\n",name);
-            free(name);
             return;
         }
 
@@ -1333,14 +1953,10 @@ void parse_command(char **buf) {
         }
 
         if (error) {
-            free(name);
             return;
         }
 
-        struct container_element _cel = { .type=dc_source->type,
-                                          .idx=dc_source->idx,
-                                          ._el=dc_source };
-        new_cmd.dc.source = _cel;
+        new_cmd.dc.source = *dc_source;
         new_cmd.dc.begin = begin;
         new_cmd.dc.end = end;
         new_cmd.dc.step = step;
@@ -1387,7 +2003,7 @@ void parse_command(char **buf) {
     }
 
     cmd_pool_size = grow((void**)&cmd_pool,cmd_pool_size,
-                         sizeof(struct command),cmd_pool_next,NO_REBUILD);
+                         sizeof(struct command),cmd_pool_next);
     cmd_pool[cmd_pool_next] = new_cmd;
     cmd_pool_next++;
 
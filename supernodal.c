@@ -0,0 +1,511 @@
+#include "supernodal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define SN_RELAX_COLS 8      //columns a relaxed supernode may grow to
+#define SN_RELAX_FILL 0.25   //fraction of explicit zeros a relaxed supernode may keep
+#define SN_TASKS 64          //subtrees of about 1/SN_TASKS of the work are tasks
+#define SN_PARALLEL_MIN 128  //rows of a front worth a parallel loop
+
+static void *supernodal_alloc(unsigned long size) {
+    void *p = malloc(size);
+    if (!p && size) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static int supernodal_merge(int *rows, int size, const int *add, int add_size, int *tmp) {
+    //the union of two ascending lists, into rows, returns its size
+    int a = 0, b = 0, k = 0;
+    while (a < size && b < add_size) {
+        if (rows[a] < add[b])
+            tmp[k++] = rows[a++];
+        else if (rows[a] > add[b])
+            tmp[k++] = add[b++];
+        else {
+            tmp[k++] = rows[a++];
+            b++;
+        }
+    }
+    while (a < size)
+        tmp[k++] = rows[a++];
+    while (b < add_size)
+        tmp[k++] = add[b++];
+    memcpy(rows,tmp,k * sizeof(int));
+    return k;
+}
+
+static void supernodal_partition(struct supernodal *L, const int *parent,
+                                 const int *count) {
+    /* Chains j -> j + 1 of the postordered elimination tree merge. A
+       fundamental supernode needs j to be the only child and the same
+       structure below, a relaxed one stays small and keeps few zeros. */
+    int n = L->n;
+    int *children = (int*)calloc(n,sizeof(int));
+    if (!children && n) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    int j;
+
+    for (j=0; j<n; ++j)
+        if (parent[j] != -1)
+            children[parent[j]]++;
+
+    L->first = (int*)supernodal_alloc((n + 1) * sizeof(int));
+    L->size = 0;
+    j = 0;
+    while (j < n) {
+        long cols = 1;
+        long nonzeros = count[j];
+        L->first[L->size++] = j;
+        while (j + 1 < n && parent[j] == j + 1) {
+            int p = j + 1;
+            int fundamental = children[p] == 1 && count[j] == count[p] + 1;
+            //the chain keeps the structure of its last column,
+            //struct(L(:,j)) \ {j} is in struct(L(:,j+1))
+            long rows = cols + count[p];
+            long stored = (cols + 1) * rows - (cols + 1) * cols / 2;
+            long zeros = stored - (nonzeros + count[p]);
+            if (!fundamental &&
+                (cols + 1 > SN_RELAX_COLS || zeros > SN_RELAX_FILL * stored))
+                break;
+            cols++;
+            nonzeros += count[p];
+            j++;
+        }
+        j++;
+    }
+    L->first[L->size] = n;
+    free(children);
+}
+
+static void supernodal_tree(struct supernodal *L, const int *parent, const int *count) {
+    //the supernodal tree and its children lists, the rows of every
+    //supernode and where its values go
+    int size = L->size;
+    int n = L->n;
+    int *owner = (int*)supernodal_alloc(n * sizeof(int));
+    int s, j;
+
+    for (s=0; s<size; ++s)
+        for (j=L->first[s]; j<L->first[s + 1]; ++j)
+            owner[j] = s;
+
+    L->parent = (int*)supernodal_alloc(size * sizeof(int));
+    L->child_p = (int*)calloc(size + 1,sizeof(int));
+    L->child = (int*)supernodal_alloc(size * sizeof(int));
+    L->rows_p = (int*)supernodal_alloc((size + 1) * sizeof(int));
+    L->lx_p = (long*)supernodal_alloc((size + 1) * sizeof(long));
+    if (!L->child_p) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    L->rows_p[0] = 0;
+    L->lx_p[0] = 0;
+    for (s=0; s<size; ++s) {
+        int last = L->first[s + 1] - 1;
+        int cols = last - L->first[s] + 1;
+        int rows = cols - 1 + count[last];
+        L->parent[s] = (parent[last] == -1) ? -1 : owner[parent[last]];
+        if (L->parent[s] != -1)
+            L->child_p[L->parent[s] + 1]++;
+        L->rows_p[s + 1] = L->rows_p[s] + rows;
+        L->lx_p[s + 1] = L->lx_p[s] + (long)rows * cols;
+    }
+    L->lnz = L->lx_p[size];
+    for (s=0; s<size; ++s)
+        L->child_p[s + 1] += L->child_p[s];
+    int *next = owner;  //done with it
+    memcpy(next,L->child_p,size * sizeof(int));
+    for (s=0; s<size; ++s)
+        if (L->parent[s] != -1)
+            L->child[next[L->parent[s]]++] = s;
+    free(owner);
+}
+
+static void supernodal_rows(struct supernodal *L, const cs *A) {
+    //the columns of s, then the rows below them of the columns of A
+    //and of the update matrices of the children, merged in order
+    int n = L->n;
+    int *tmp = (int*)supernodal_alloc(n * sizeof(int));
+    int *mark = (int*)supernodal_alloc(n * sizeof(int));
+    int s, j, k, p;
+
+    L->rows = (int*)supernodal_alloc(L->rows_p[L->size] * sizeof(int));
+    for (j=0; j<n; ++j)
+        mark[j] = -1;
+
+    for (s=0; s<L->size; ++s) {
+        int first = L->first[s];
+        int last = L->first[s + 1] - 1;
+        int *rows = L->rows + L->rows_p[s];
+        int pos = 0;
+
+        for (j=first; j<=last; ++j)
+            rows[pos++] = j;
+        int *below = rows + pos;
+        int size = 0;
+        for (j=first; j<=last; ++j) {
+            int col = L->q[j];
+            for (p=A->p[col]; p<A->p[col + 1]; ++p) {
+                int r = L->pinv[A->i[p]];
+                if (r > last && mark[r] != s) {
+                    //a few rows per column, insertion sort
+                    mark[r] = s;
+                    for (k=size++; k > 0 && below[k - 1] > r; --k)
+                        below[k] = below[k - 1];
+                    below[k] = r;
+                }
+            }
+        }
+        for (k=L->child_p[s]; k<L->child_p[s + 1]; ++k) {
+            int c = L->child[k];
+            p = L->rows_p[c] + L->first[c + 1] - L->first[c];
+            while (p < L->rows_p[c + 1] && L->rows[p] <= last)
+                p++;
+            size = supernodal_merge(below,size,L->rows + p,L->rows_p[c + 1] - p,tmp);
+        }
+        assert(pos + size == L->rows_p[s + 1] - L->rows_p[s]);
+    }
+    free(mark);
+    free(tmp);
+}
+
+static void supernodal_schedule(struct supernodal *L) {
+    //the largest subtrees under 1/SN_TASKS of the flops are tasks
+    int size = L->size;
+    double *work = (double*)supernodal_alloc(size * sizeof(double));
+    int *subtree = (int*)supernodal_alloc(size * sizeof(int));
+    double total = 0;
+    int s;
+
+    for (s=0; s<size; ++s) {
+        work[s] = 0;
+        subtree[s] = 0;
+    }
+    for (s=0; s<size; ++s) {
+        double cols = L->first[s + 1] - L->first[s];
+        double rows = L->rows_p[s + 1] - L->rows_p[s];
+        work[s] += cols * rows * rows;
+        subtree[s] += 1;
+        total += cols * rows * rows;
+        if (L->parent[s] != -1) {
+            work[L->parent[s]] += work[s];
+            subtree[L->parent[s]] += subtree[s];
+        }
+    }
+
+    double limit = total / SN_TASKS;
+    L->tasks = 0;
+    L->task_first = (int*)supernodal_alloc(size * sizeof(int));
+    L->task_root = (int*)supernodal_alloc(size * sizeof(int));
+    L->top = (int*)supernodal_alloc(size * sizeof(int));
+    L->top_size = 0;
+    for (s=0; s<size; ++s) {
+        int p = L->parent[s];
+        if (work[s] > limit)
+            L->top[L->top_size++] = s;
+        else if (p == -1 || work[p] > limit) {
+            L->task_first[L->tasks] = s - subtree[s] + 1;
+            L->task_root[L->tasks] = s;
+            L->tasks++;
+        }
+    }
+    free(work);
+    free(subtree);
+}
+
+struct supernodal *supernodal_analyse(const cs *A) {
+    //the symbolic analysis of cs_schol(1,A), postordered
+    int n = A->n;
+    int *P = cs_amd(1,A);
+    int *pinv = cs_pinv(P,n);
+    cs_free(P);
+    if (!pinv)
+        return NULL;
+    cs *C = cs_symperm(A,pinv,0);
+    int *parent = cs_etree(C,0);
+    int *post = cs_post(parent,n);
+    int *count = cs_counts(C,parent,post,0);
+    cs_spfree(C);
+    if (!parent || !post || !count) {
+        cs_free(pinv);
+        cs_free(parent);
+        cs_free(post);
+        cs_free(count);
+        return NULL;
+    }
+
+    struct supernodal *L = (struct supernodal*)calloc(1,sizeof(struct supernodal));
+    if (!L) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    L->n = n;
+    L->pinv = (int*)supernodal_alloc(n * sizeof(int));
+    L->q = (int*)supernodal_alloc(n * sizeof(int));
+
+    //relabel in postorder, the columns of a subtree become a range
+    int *ipost = (int*)supernodal_alloc(n * sizeof(int));
+    int *post_parent = (int*)supernodal_alloc(n * sizeof(int));
+    int *post_count = (int*)supernodal_alloc(n * sizeof(int));
+    int i, k;
+    for (k=0; k<n; ++k)
+        ipost[post[k]] = k;
+    for (i=0; i<n; ++i) {
+        L->pinv[i] = ipost[pinv[i]];
+        L->q[L->pinv[i]] = i;
+    }
+    for (k=0; k<n; ++k) {
+        int p = parent[post[k]];
+        post_parent[k] = (p == -1) ? -1 : ipost[p];
+        post_count[k] = count[post[k]];
+    }
+    cs_free(pinv);
+    cs_free(parent);
+    cs_free(post);
+    cs_free(count);
+    free(ipost);
+
+    supernodal_partition(L,post_parent,post_count);
+    supernodal_tree(L,post_parent,post_count);
+    supernodal_rows(L,A);
+    supernodal_schedule(L);
+    free(post_parent);
+    free(post_count);
+
+    L->lx = (dfloat_t*)supernodal_alloc(L->lnz * sizeof(dfloat_t));
+    return L;
+}
+
+static void supernodal_rank(dfloat_t *t, int t_first, const dfloat_t *P, long m,
+                            int cols, int c, int from, int to) {
+    //t[r - t_first] -= sum P(r,i) * P(c,i) over the first cols columns
+    //of P, rows from .. to - 1, four columns a pass
+    int i, r;
+    for (i=0; i+3<cols; i+=4) {
+        const dfloat_t *p0 = P + i * m;
+        const dfloat_t *p1 = p0 + m;
+        const dfloat_t *p2 = p1 + m;
+        const dfloat_t *p3 = p2 + m;
+        dfloat_t l0 = p0[c], l1 = p1[c], l2 = p2[c], l3 = p3[c];
+        if (l0 == 0 && l1 == 0 && l2 == 0 && l3 == 0)
+            continue;
+        for (r=from; r<to; ++r)
+            t[r - t_first] -= p0[r] * l0 + p1[r] * l1 + p2[r] * l2 + p3[r] * l3;
+    }
+    for (; i<cols; ++i) {
+        const dfloat_t *p0 = P + i * m;
+        dfloat_t l0 = p0[c];
+        if (l0 == 0)
+            continue;
+        for (r=from; r<to; ++r)
+            t[r - t_first] -= p0[r] * l0;
+    }
+}
+
+static int supernodal_front(struct supernodal *L, const cs *A, int s,
+                            dfloat_t **update, int *map, const int parallel) {
+    /* The front of s, its columns P (rows x cols, in L->lx) and the update
+       matrix T of the rows below (lower triangle, below x below). Returns
+       0 if A is not positive definite. */
+    int first = L->first[s];
+    int cols = L->first[s + 1] - first;
+    int *rows = L->rows + L->rows_p[s];
+    int m = L->rows_p[s + 1] - L->rows_p[s];
+    int below = m - cols;
+    dfloat_t *P = L->lx + L->lx_p[s];
+    dfloat_t *T = NULL;
+    int a, b, c, j, k, p;
+
+    memset(P,0,(long)m * cols * sizeof(dfloat_t));
+    if (below) {
+        T = (dfloat_t*)calloc((long)below * below,sizeof(dfloat_t));
+        if (!T) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (a=0; a<m; ++a)
+        map[rows[a]] = a;
+
+    //the lower triangle of the columns of A
+    for (j=0; j<cols; ++j) {
+        int col = L->q[first + j];
+        for (p=A->p[col]; p<A->p[col + 1]; ++p) {
+            int r = L->pinv[A->i[p]];
+            if (r >= first + j)
+                P[map[r] + (long)j * m] += A->x[p];
+        }
+    }
+
+    //extend-add the update matrices of the children
+    for (k=L->child_p[s]; k<L->child_p[s + 1]; ++k) {
+        int child = L->child[k];
+        int child_cols = L->first[child + 1] - L->first[child];
+        int *child_rows = L->rows + L->rows_p[child] + child_cols;
+        int child_below = L->rows_p[child + 1] - L->rows_p[child] - child_cols;
+        dfloat_t *U = update[child];
+        for (b=0; b<child_below; ++b) {
+            int col = map[child_rows[b]];
+            dfloat_t *u = U + (long)b * child_below;
+            if (col < cols) {
+                dfloat_t *target = P + (long)col * m;
+                for (a=b; a<child_below; ++a)
+                    target[map[child_rows[a]]] += u[a];
+            }
+            else {
+                dfloat_t *target = T + (long)(col - cols) * below;
+                for (a=b; a<child_below; ++a)
+                    target[map[child_rows[a]] - cols] += u[a];
+            }
+        }
+        free(U);
+        update[child] = NULL;
+    }
+
+    //the columns of s, left looking, the rows of a front split among
+    //threads
+    for (j=0; j<cols; ++j) {
+        dfloat_t *pj = P + (long)j * m;
+        if (parallel && m - j >= 8 * SN_PARALLEL_MIN) {
+#pragma omp parallel for
+            for (a=j; a<m; a+=SN_PARALLEL_MIN) {
+                int end = (a + SN_PARALLEL_MIN < m) ? a + SN_PARALLEL_MIN : m;
+                supernodal_rank(pj,0,P,m,j,j,a,end);
+            }
+        }
+        else
+            supernodal_rank(pj,0,P,m,j,j,j,m);
+        dfloat_t d = pj[j];
+        if (!(d > 0)) {
+            free(T);
+            return 0;
+        }
+        d = sqrt(d);
+        pj[j] = d;
+        d = 1 / d;
+        for (a=j+1; a<m; ++a)
+            pj[a] *= d;
+    }
+
+    //T -= L21 * L21'
+    if (parallel && below >= SN_PARALLEL_MIN) {
+#pragma omp parallel for schedule(dynamic,8)
+        for (c=0; c<below; ++c)
+            supernodal_rank(T + (long)c * below,cols,P,m,cols,cols + c,cols + c,m);
+    }
+    else
+        for (c=0; c<below; ++c)
+            supernodal_rank(T + (long)c * below,cols,P,m,cols,cols + c,cols + c,m);
+
+    update[s] = T;
+    return 1;
+}
+
+int supernodal_factor(struct supernodal *L, const cs *A) {
+    //returns 0 if A is not positive definite
+    dfloat_t **update = (dfloat_t**)calloc(L->size,sizeof(dfloat_t*));
+    if (!update && L->size) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    int failed = 0;
+    int t, s;
+
+#pragma omp parallel reduction(||:failed)
+    {
+        int *map = (int*)supernodal_alloc(L->n * sizeof(int));
+#pragma omp for schedule(dynamic)
+        for (t=0; t<L->tasks; ++t) {
+            int k;
+            for (k=L->task_first[t]; k<=L->task_root[t] && !failed; ++k)
+                failed = !supernodal_front(L,A,k,update,map,0);
+        }
+        free(map);
+    }
+
+    int *map = (int*)supernodal_alloc(L->n * sizeof(int));
+    for (t=0; t<L->top_size && !failed; ++t)
+        failed = !supernodal_front(L,A,L->top[t],update,map,1);
+    free(map);
+
+    for (s=0; s<L->size; ++s)
+        free(update[s]);
+    free(update);
+    return !failed;
+}
+
+void supernodal_solve(const struct supernodal *L, const dfloat_t *b, dfloat_t *x, dfloat_t *w) {
+    //x = A \ b, w is n scratch values
+    int n = L->n;
+    int s, i, j, r;
+
+    for (i=0; i<n; ++i)
+        w[L->pinv[i]] = b[i];
+
+    //L
+    for (s=0; s<L->size; ++s) {
+        int first = L->first[s];
+        int cols = L->first[s + 1] - first;
+        int *rows = L->rows + L->rows_p[s];
+        int m = L->rows_p[s + 1] - L->rows_p[s];
+        dfloat_t *P = L->lx + L->lx_p[s];
+        for (j=0; j<cols; ++j) {
+            dfloat_t *pj = P + (long)j * m;
+            dfloat_t wj = w[first + j] / pj[j];
+            w[first + j] = wj;
+            if (wj == 0)
+                continue;
+            for (r=j+1; r<m; ++r)
+                w[rows[r]] -= pj[r] * wj;
+        }
+    }
+
+    //L'
+    for (s=L->size; s-- > 0; ) {
+        int first = L->first[s];
+        int cols = L->first[s + 1] - first;
+        int *rows = L->rows + L->rows_p[s];
+        int m = L->rows_p[s + 1] - L->rows_p[s];
+        dfloat_t *P = L->lx + L->lx_p[s];
+        for (j=cols; j-- > 0; ) {
+            dfloat_t *pj = P + (long)j * m;
+            dfloat_t sum = w[first + j];
+            for (r=j+1; r<m; ++r)
+                sum -= pj[r] * w[rows[r]];
+            w[first + j] = sum / pj[j];
+        }
+    }
+
+    for (i=0; i<n; ++i)
+        x[i] = w[L->pinv[i]];
+}
+
+struct supernodal *supernodal_free(struct supernodal *L) {
+    if (!L)
+        return NULL;
+    free(L->pinv);
+    free(L->q);
+    free(L->first);
+    free(L->parent);
+    free(L->child);
+    free(L->child_p);
+    free(L->rows_p);
+    free(L->rows);
+    free(L->lx_p);
+    free(L->lx);
+    free(L->task_first);
+    free(L->task_root);
+    free(L->top);
+    free(L);
+    return NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef __SUPERNODAL_H__
+#define __SUPERNODAL_H__
+
+#include "datatypes.h"
+#include "csparse/csparse.h"
+
+/* Supernodal sparse cholesky, for .option spd sparse.
+
+   supernodal_analyse() orders A with amd (as cs_schol()), postorders the
+   elimination tree and groups chains of columns with (nearly) the same
+   structure into supernodes. A supernode keeps its columns of L as one
+   dense block, column major, its rows are listed in rows[].
+
+   supernodal_factor() is multifrontal, every supernode assembles its
+   columns of A and the update matrices of its children, factors its
+   columns with dense kernels and leaves the update matrix of its rows
+   below to its parent. Subtrees of the supernodal tree do not depend on
+   each other, they are factored in parallel, the supernodes above them
+   (the big fronts) parallelize their dense kernels instead. */
+
+struct supernodal {
+    int n;
+    int *pinv;    //fill reducing order, as css.pinv
+    int *q;       //the inverse of pinv
+
+    int size;     //supernodes, in postorder
+    int *first;   //first column of every supernode, size + 1
+    int *parent;  //supernodal elimination tree, -1 for the roots
+    int *child;   //children of s at child[child_p[s] .. child_p[s + 1])
+    int *child_p;
+    int *rows_p;  //rows of s at rows[rows_p[s] .. rows_p[s + 1]), ascending,
+    int *rows;    //the columns of s come first
+    long *lx_p;   //L of s at lx[lx_p[s] ..], rows x columns
+    dfloat_t *lx;
+    long lnz;     //values in lx, explicit zeros of relaxed supernodes included
+
+    //parallel schedule, task t is the subtree of supernodes
+    //task_first[t] .. task_root[t], the top supernodes come after them
+    int tasks;
+    int *task_first;
+    int *task_root;
+    int top_size;
+    int *top;  //ascending
+
+};
+
+struct supernodal *supernodal_analyse(const cs *A);
+int supernodal_factor(struct supernodal *L, const cs *A);
+void supernodal_solve(const struct supernodal *L, const dfloat_t *b, dfloat_t *x, dfloat_t *w);
+struct supernodal *supernodal_free(struct supernodal *L);
+
+#endif
@@ -0,0 +1,595 @@
+#include "topology.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+static void *topology_alloc(unsigned long size) {
+    void *p = malloc(size);
+    if (!p && size) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static unsigned long find_root(unsigned long *parent, dfloat_t *offset,
+                               unsigned long a) {
+    //v(a) = v(root) + offset[a] on return, the path is compressed
+    unsigned long root = a;
+    dfloat_t sum = 0;
+    while (parent[root] != root) {
+        sum += offset[root];
+        root = parent[root];
+    }
+    while (parent[a] != a) {
+        unsigned long next = parent[a];
+        dfloat_t step = offset[a];
+        offset[a] = sum;
+        parent[a] = root;
+        sum -= step;
+        a = next;
+    }
+    return root;
+}
+
+static void device_array_alloc(struct device_array *dev, unsigned long size) {
+    //one block, as the parser does
+    dev->size = 0;
+    dev->vplus = (unsigned long*)topology_alloc(size * (3 * sizeof(unsigned long) +
+                                                        sizeof(dfloat_t)));
+    dev->vminus = &dev->vplus[size];
+    dev->idx = &dev->vminus[size];
+    dev->value = (dfloat_t*)&dev->idx[size];
+}
+
+static void device_array_push(struct device_array *dev, unsigned long vplus,
+                              unsigned long vminus, unsigned long idx,
+                              dfloat_t value) {
+    unsigned long k = dev->size++;
+    dev->vplus[k] = vplus;
+    dev->vminus[k] = vminus;
+    dev->idx[k] = idx;
+    dev->value[k] = value;
+}
+
+static char *dynamic_nodes(struct netlist_info *netlist, const int transient,
+                           struct element *swept) {
+    //nodes whose KCL changes after the dc point
+    struct device_table *dev = &netlist->devices;
+    char *dynamic = (char*)topology_alloc(netlist->n);
+    unsigned long k;
+
+    memset(dynamic,0,netlist->n);
+    for (k=0; transient && k<dev->c.size; ++k) {
+        dynamic[dev->c.vplus[k]] = 1;
+        dynamic[dev->c.vminus[k]] = 1;
+    }
+    for (k=0; k<dev->i.size; ++k) {
+        struct element *el = &netlist->el_group1_pool[dev->i.idx[k]];
+        if (el->i->transient || el == swept) {
+            dynamic[dev->i.vplus[k]] = 1;
+            dynamic[dev->i.vminus[k]] = 1;
+        }
+    }
+    //the ground node closes no KCL
+    dynamic[0] = 0;
+    return dynamic;
+}
+
+static void topology_tree(struct netlist_info *netlist, struct topology *t,
+                          unsigned long *parent, char *removed) {
+    //the removed sources are a spanning forest of the merged sets, walk
+    //every tree from its root and keep the nodes in reverse order
+    struct device_array *v = &netlist->devices.v;
+    unsigned long size = netlist->n;
+    unsigned long *degree = (unsigned long*)topology_alloc((size + 1) * sizeof(unsigned long));
+    unsigned long *adj = (unsigned long*)topology_alloc(2 * t->tree_size * sizeof(unsigned long));
+    unsigned long *queue = (unsigned long*)topology_alloc(size * sizeof(unsigned long));
+    unsigned long *via = (unsigned long*)topology_alloc(size * sizeof(unsigned long));
+    unsigned long i;
+    unsigned long k;
+
+    memset(degree,0,(size + 1) * sizeof(unsigned long));
+    for (k=0; k<v->size; ++k)
+        if (removed[k]) {
+            degree[v->vplus[k] + 1]++;
+            degree[v->vminus[k] + 1]++;
+        }
+    for (i=0; i<size; ++i)
+        degree[i + 1] += degree[i];
+    for (k=0; k<v->size; ++k)
+        if (removed[k]) {
+            adj[degree[v->vplus[k]]++] = k;
+            adj[degree[v->vminus[k]]++] = k;
+        }
+    //degree[i] is the end of the edges of i now, shift back
+    for (i=size; i>0; --i)
+        degree[i] = degree[i - 1];
+    degree[0] = 0;
+
+    for (i=0; i<size; ++i)
+        via[i] = ULONG_MAX;
+
+    unsigned long head = 0;
+    unsigned long tail = 0;
+    for (i=0; i<size; ++i) {
+        if (parent[i] != i || degree[i] == degree[i + 1])
+            continue;
+        queue[tail++] = i;
+        while (head < tail) {
+            unsigned long a = queue[head++];
+            unsigned long e;
+            for (e=degree[a]; e<degree[a + 1]; ++e) {
+                k = adj[e];
+                if (k == via[a])
+                    continue;
+                unsigned long b = (v->vplus[k] == a) ? v->vminus[k] : v->vplus[k];
+                via[b] = k;
+                queue[tail++] = b;
+            }
+        }
+    }
+    unsigned long next = 0;
+    while (tail--) {
+        unsigned long a = queue[tail];
+        if (via[a] == ULONG_MAX)
+            continue;  //root
+        assert(next < t->tree_size);
+        t->tree_node[next] = a;
+        t->tree_source[next] = via[a];
+        next++;
+    }
+    assert(next == t->tree_size);
+
+    free(degree);
+    free(adj);
+    free(queue);
+    free(via);
+}
+
+static void topology_probed(struct netlist_info *netlist, struct topology *t) {
+    unsigned long i;
+    unsigned long j;
+    for (i=0; i<netlist->cmd_pool_size; ++i) {
+        struct command *cmd = &netlist->cmd_pool[i];
+        if (cmd->type != CMD_PRINT && cmd->type != CMD_PLOT)
+            continue;
+        for (j=0; j<cmd->print_plot.item_num; ++j) {
+            struct cmd_print_plot_item *item = &cmd->print_plot.item[j];
+            if (item->type == 'i' && item->cel._el->type == 'v' &&
+                t->branch[item->cel._el->idx] == ULONG_MAX)
+                t->probed = 1;
+        }
+    }
+}
+
+static void topology_devices(struct netlist_info *netlist, struct topology *t,
+                             char *removed, unsigned long _n) {
+    struct device_table *dev = &netlist->devices;
+    struct device_table *red = &t->netlist.devices;
+    unsigned long *node = t->node;
+    dfloat_t *offset = t->node_offset;
+    dfloat_t *rhs = t->rhs;
+    unsigned long k;
+
+    device_array_alloc(&red->r,dev->r.size);
+    device_array_alloc(&red->c,dev->c.size);
+    device_array_alloc(&red->l,dev->l.size);
+    device_array_alloc(&red->v,dev->v.size);
+    device_array_alloc(&red->i,dev->i.size);
+
+    //devices inside a merged set carry a constant current, it only shows
+    //in the currents of the removed sources
+    for (k=0; k<dev->r.size; ++k) {
+        unsigned long a = dev->r.vplus[k];
+        unsigned long b = dev->r.vminus[k];
+        if (node[a] == node[b])
+            continue;
+        dfloat_t g = dev->r.value[k];
+        device_array_push(&red->r,node[a],node[b],dev->r.idx[k],g);
+
+        //g * (offset[a] - offset[b]) goes from a to b whatever the voltages
+        dfloat_t current = g * (offset[a] - offset[b]);
+        if (current == 0)
+            continue;
+        if (node[a])
+            rhs[node[a] - 1] -= current;
+        if (node[b])
+            rhs[node[b] - 1] += current;
+    }
+
+    for (k=0; k<dev->c.size; ++k) {
+        unsigned long a = dev->c.vplus[k];
+        unsigned long b = dev->c.vminus[k];
+        if (node[a] != node[b])
+            device_array_push(&red->c,node[a],node[b],dev->c.idx[k],dev->c.value[k]);
+    }
+
+    for (k=0; k<dev->i.size; ++k) {
+        unsigned long a = dev->i.vplus[k];
+        unsigned long b = dev->i.vminus[k];
+        if (node[a] != node[b])
+            device_array_push(&red->i,node[a],node[b],dev->i.idx[k],dev->i.value[k]);
+    }
+
+    //branch rows are v(a) - v(b) = value, move the offsets to the right
+    for (k=0; k<dev->v.size; ++k) {
+        if (removed[k])
+            continue;
+        unsigned long a = dev->v.vplus[k];
+        unsigned long b = dev->v.vminus[k];
+        unsigned long idx = t->branch[dev->v.idx[k]];
+        device_array_push(&red->v,node[a],node[b],idx,dev->v.value[k]);
+        rhs[_n + idx] += offset[b] - offset[a];
+    }
+
+    for (k=0; k<dev->l.size; ++k) {
+        unsigned long a = dev->l.vplus[k];
+        unsigned long b = dev->l.vminus[k];
+        unsigned long idx = t->branch[dev->l.idx[k]];
+        device_array_push(&red->l,node[a],node[b],idx,dev->l.value[k]);
+        rhs[_n + idx] += offset[b] - offset[a];
+    }
+}
+
+static unsigned long topology_bandwidth(struct netlist_info *netlist,
+                                        const unsigned long *node) {
+    //over the node to node couplings of r, c, l and v
+    struct device_table *dev = &netlist->devices;
+    struct device_array *arrays[4] = { &dev->r, &dev->c, &dev->l, &dev->v };
+    unsigned long bandwidth = 0;
+    unsigned long k;
+    int d;
+    for (d=0; d<4; ++d)
+        for (k=0; k<arrays[d]->size; ++k) {
+            unsigned long a = node[arrays[d]->vplus[k]];
+            unsigned long b = node[arrays[d]->vminus[k]];
+            if (!a || !b)
+                continue;
+            if (a > b && a - b > bandwidth)
+                bandwidth = a - b;
+            if (b > a && b - a > bandwidth)
+                bandwidth = b - a;
+        }
+    return bandwidth;
+}
+
+static void topology_rcm(struct netlist_info *netlist, struct topology *t,
+                         const unsigned long _n) {
+    /* Reverse Cuthill-McKee over the reduced nodes, v and l couple their
+       nodes through the branch. Every component starts from a node of
+       least degree, neighbours are visited by increasing degree. t->node
+       is relabeled in place. */
+    struct device_table *dev = &netlist->devices;
+    struct device_array *arrays[4] = { &dev->r, &dev->c, &dev->l, &dev->v };
+    unsigned long *node = t->node;
+    unsigned long *start = (unsigned long*)topology_alloc((_n + 2) * sizeof(unsigned long));
+    unsigned long *next = (unsigned long*)topology_alloc((_n + 2) * sizeof(unsigned long));
+    unsigned long *by_degree = (unsigned long*)topology_alloc((_n + 1) * sizeof(unsigned long));
+    unsigned long *label = (unsigned long*)topology_alloc((_n + 1) * sizeof(unsigned long));
+    unsigned long edges = 0;
+    unsigned long i;
+    unsigned long k;
+    int d;
+
+    //degrees, duplicate couplings included
+    memset(start,0,(_n + 2) * sizeof(unsigned long));
+    for (d=0; d<4; ++d)
+        for (k=0; k<arrays[d]->size; ++k) {
+            unsigned long a = node[arrays[d]->vplus[k]];
+            unsigned long b = node[arrays[d]->vminus[k]];
+            if (a && b && a != b) {
+                start[a + 1]++;
+                start[b + 1]++;
+                edges += 2;
+            }
+        }
+
+    //the nodes by increasing degree, counting sort, degrees past _n
+    //(parallel devices) share the last bucket
+    memset(next,0,(_n + 2) * sizeof(unsigned long));
+    for (i=1; i<=_n; ++i)
+        next[start[i + 1] < _n ? start[i + 1] : _n]++;
+    unsigned long sum = 0;
+    for (i=0; i<=_n + 1; ++i) {
+        unsigned long count = next[i];
+        next[i] = sum;
+        sum += count;
+    }
+    for (i=1; i<=_n; ++i)
+        by_degree[next[start[i + 1] < _n ? start[i + 1] : _n]++] = i;
+
+    for (i=1; i<=_n + 1; ++i)
+        start[i] += start[i - 1];
+
+    //the neighbours of every node, unsorted first
+    unsigned long *adj = (unsigned long*)topology_alloc(edges * sizeof(unsigned long));
+    unsigned long *sorted = (unsigned long*)topology_alloc(edges * sizeof(unsigned long));
+    memcpy(next,start,(_n + 2) * sizeof(unsigned long));
+    for (d=0; d<4; ++d)
+        for (k=0; k<arrays[d]->size; ++k) {
+            unsigned long a = node[arrays[d]->vplus[k]];
+            unsigned long b = node[arrays[d]->vminus[k]];
+            if (a && b && a != b) {
+                adj[next[a]++] = b;
+                adj[next[b]++] = a;
+            }
+        }
+
+    //then by increasing degree, a node goes to the lists of its
+    //neighbours in the order of by_degree[]
+    memcpy(next,start,(_n + 2) * sizeof(unsigned long));
+    for (i=0; i<_n; ++i) {
+        unsigned long a = by_degree[i];
+        unsigned long e;
+        for (e=start[a]; e<start[a + 1]; ++e)
+            sorted[next[adj[e]]++] = a;
+    }
+    free(adj);
+
+    //breadth first, label[] is the visit order and 0 for not visited
+    unsigned long *queue = next;
+    unsigned long visited = 0;
+    memset(label,0,(_n + 1) * sizeof(unsigned long));
+    for (i=0; i<_n; ++i) {
+        unsigned long root = by_degree[i];
+        if (label[root])
+            continue;
+        unsigned long head = visited;
+        label[root] = ++visited;
+        queue[visited - 1] = root;
+        while (head < visited) {
+            unsigned long a = queue[head++];
+            unsigned long e;
+            for (e=start[a]; e<start[a + 1]; ++e) {
+                unsigned long b = sorted[e];
+                if (label[b])
+                    continue;
+                label[b] = ++visited;
+                queue[visited - 1] = b;
+            }
+        }
+    }
+    assert(visited == _n);
+
+    //reversed
+    for (i=1; i<=_n; ++i)
+        label[i] = _n + 1 - label[i];
+    label[0] = 0;
+    for (i=0; i<=t->n; ++i)
+        node[i] = label[node[i]];
+
+    free(start);
+    free(next);
+    free(by_degree);
+    free(label);
+    free(sorted);
+}
+
+static void topology_branches(struct netlist_info *netlist, struct topology *t,
+                              const unsigned long _n, const int relabel) {
+    //the kept branches, in pool order or by their first node
+    struct device_table *dev = &netlist->devices;
+    struct device_array *arrays[2] = { &dev->l, &dev->v };
+    unsigned long *branch = t->branch;
+    unsigned long i;
+    unsigned long k;
+    int d;
+
+    if (!relabel) {
+        unsigned long branches = 0;
+        for (i=0; i<t->el_group2_size; ++i)
+            if (branch[i] != ULONG_MAX)
+                branch[i] = branches++;
+        return;
+    }
+
+    //counting sort on the lower nonzero label of the nodes
+    unsigned long *count = (unsigned long*)topology_alloc((_n + 2) * sizeof(unsigned long));
+    memset(count,0,(_n + 2) * sizeof(unsigned long));
+    for (d=0; d<2; ++d)
+        for (k=0; k<arrays[d]->size; ++k) {
+            unsigned long idx = arrays[d]->idx[k];
+            unsigned long a = t->node[arrays[d]->vplus[k]];
+            unsigned long b = t->node[arrays[d]->vminus[k]];
+            if (branch[idx] == ULONG_MAX)
+                continue;
+            branch[idx] = (a && (a < b || !b)) ? a : b;
+            count[branch[idx] + 1]++;
+        }
+    for (i=1; i<=_n + 1; ++i)
+        count[i] += count[i - 1];
+    for (i=0; i<t->el_group2_size; ++i)
+        if (branch[i] != ULONG_MAX)
+            branch[i] = count[branch[i]]++;
+    free(count);
+}
+
+void topology_reduce(struct netlist_info *netlist, struct topology *t,
+                     const int transient, struct element *swept,
+                     const int relabel) {
+    struct device_array *v = &netlist->devices.v;
+    unsigned long size = netlist->n;  //with the ground node
+    unsigned long i;
+    unsigned long k;
+
+    memset(t,0,sizeof(struct topology));
+    t->n = size - 1;
+    t->el_group2_size = netlist->el_group2_size;
+
+    if (!v->size && !relabel)
+        return;
+
+    unsigned long *parent = (unsigned long*)topology_alloc(size * sizeof(unsigned long));
+    unsigned long *rank = (unsigned long*)topology_alloc(size * sizeof(unsigned long));
+    dfloat_t *offset = (dfloat_t*)topology_alloc(size * sizeof(dfloat_t));
+    char *removed = (char*)topology_alloc(v->size);
+    char *dynamic = dynamic_nodes(netlist,transient,swept);
+
+    for (i=0; i<size; ++i) {
+        parent[i] = i;
+        rank[i] = 0;
+        offset[i] = 0;
+    }
+
+    for (k=0; k<v->size; ++k) {
+        struct element *el = &netlist->el_group2_pool[v->idx[k]];
+        unsigned long a = v->vplus[k];
+        unsigned long b = v->vminus[k];
+
+        removed[k] = 0;
+        if (el->v->transient || el == swept || dynamic[a] || dynamic[b])
+            continue;
+
+        unsigned long ra = find_root(parent,offset,a);
+        unsigned long rb = find_root(parent,offset,b);
+        if (ra == rb)
+            continue;  //a loop of sources, leave it to the solver
+
+        //v(ra) - v(rb) = value + offset[b] - offset[a],
+        //the ground node stays a root
+        dfloat_t diff = v->value[k] + offset[b] - offset[a];
+        if (rb == 0 || (ra != 0 && rank[ra] < rank[rb])) {
+            parent[ra] = rb;
+            offset[ra] = diff;
+        }
+        else {
+            parent[rb] = ra;
+            offset[rb] = -diff;
+            if (rank[ra] == rank[rb])
+                rank[ra]++;
+        }
+        removed[k] = 1;
+        t->tree_size++;
+    }
+    free(dynamic);
+
+    if (!t->tree_size && !relabel) {
+        free(parent);
+        free(rank);
+        free(offset);
+        free(removed);
+        return;
+    }
+
+    //number the roots in nuid order, the ground node stays 0
+    t->active = 1;
+    t->node = (unsigned long*)topology_alloc(size * sizeof(unsigned long));
+    t->node_offset = offset;
+    unsigned long _n = 0;
+    for (i=0; i<size; ++i)
+        rank[i] = ULONG_MAX;
+    rank[0] = 0;
+    for (i=0; i<size; ++i) {
+        unsigned long root = find_root(parent,offset,i);
+        if (rank[root] == ULONG_MAX)
+            rank[root] = ++_n;
+        t->node[i] = rank[root];
+    }
+
+    if (relabel) {
+        t->bandwidth[0] = topology_bandwidth(netlist,t->node);
+        topology_rcm(netlist,t,_n);
+        t->bandwidth[1] = topology_bandwidth(netlist,t->node);
+    }
+
+    t->branch = (unsigned long*)topology_alloc(t->el_group2_size * sizeof(unsigned long));
+    for (i=0; i<t->el_group2_size; ++i)
+        t->branch[i] = 0;
+    for (k=0; k<v->size; ++k)
+        if (removed[k])
+            t->branch[v->idx[k]] = ULONG_MAX;
+    unsigned long branches = t->el_group2_size - t->tree_size;
+    topology_branches(netlist,t,_n,relabel);
+
+    t->rhs = (dfloat_t*)topology_alloc((_n + branches) * sizeof(dfloat_t));
+    memset(t->rhs,0,(_n + branches) * sizeof(dfloat_t));
+
+    t->netlist = *netlist;
+    t->netlist.n = _n + 1;
+    t->netlist.el_group2_size = branches;
+    topology_devices(netlist,t,removed,_n);
+
+    t->tree_node = (unsigned long*)topology_alloc(t->tree_size * sizeof(unsigned long));
+    t->tree_source = (unsigned long*)topology_alloc(t->tree_size * sizeof(unsigned long));
+    topology_tree(netlist,t,parent,removed);
+
+    t->x = (dfloat_t*)topology_alloc((t->n + t->el_group2_size) * sizeof(dfloat_t));
+    t->kcl = (dfloat_t*)topology_alloc(size * sizeof(dfloat_t));
+    topology_probed(netlist,t);
+
+    free(parent);
+    free(rank);
+    free(removed);
+}
+
+void topology_expand(struct netlist_info *netlist, struct topology *t,
+                     const dfloat_t *x) {
+    //x of the reduced system to t->x of the full one
+    assert(t->active);
+    struct device_table *dev = &netlist->devices;
+    unsigned long _n = t->netlist.n - 1;
+    unsigned long n = t->n;
+    dfloat_t *full = t->x;
+    dfloat_t *kcl = t->kcl;
+    unsigned long i;
+    unsigned long k;
+
+    for (i=1; i<=n; ++i) {
+        unsigned long a = t->node[i];
+        dfloat_t value = a ? x[a - 1] : 0;
+        if (t->node_offset[i])
+            value += t->node_offset[i];
+        full[i - 1] = value;
+    }
+    for (i=0; i<t->el_group2_size; ++i)
+        if (t->branch[i] != ULONG_MAX)
+            full[n + i] = x[_n + t->branch[i]];
+
+    //what leaves every node through the devices the solver knows,
+    //kcl[0] is the ground node and is never read
+    memset(kcl,0,(n + 1) * sizeof(dfloat_t));
+    for (k=0; k<dev->r.size; ++k) {
+        unsigned long a = dev->r.vplus[k];
+        unsigned long b = dev->r.vminus[k];
+        dfloat_t current = dev->r.value[k] *
+            ((a ? full[a - 1] : 0) - (b ? full[b - 1] : 0));
+        kcl[a] += current;
+        kcl[b] -= current;
+    }
+    for (k=0; k<dev->i.size; ++k) {
+        kcl[dev->i.vplus[k]] += dev->i.value[k];
+        kcl[dev->i.vminus[k]] -= dev->i.value[k];
+    }
+    for (k=0; k<dev->l.size; ++k) {
+        dfloat_t current = full[n + dev->l.idx[k]];
+        kcl[dev->l.vplus[k]] += current;
+        kcl[dev->l.vminus[k]] -= current;
+    }
+    for (k=0; k<dev->v.size; ++k) {
+        if (t->branch[dev->v.idx[k]] == ULONG_MAX)
+            continue;
+        dfloat_t current = full[n + dev->v.idx[k]];
+        kcl[dev->v.vplus[k]] += current;
+        kcl[dev->v.vminus[k]] -= current;
+    }
+
+    //leaves first, the source closes the KCL of its node
+    for (k=0; k<t->tree_size; ++k) {
+        unsigned long a = t->tree_node[k];
+        unsigned long s = t->tree_source[k];
+        dfloat_t current;
+        if (dev->v.vplus[s] == a) {
+            current = -kcl[a];
+            kcl[dev->v.vminus[s]] -= current;
+        }
+        else {
+            current = kcl[a];
+            kcl[dev->v.vplus[s]] += current;
+        }
+        full[n + dev->v.idx[s]] = current;
+    }
+}
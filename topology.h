@@ -0,0 +1,65 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include "datatypes.h"
+
+/* Topology pre-pass, between the parser and the assembly of the matrices.
+
+   A voltage source of constant value ties its nodes, v(a) = v(b) + value.
+   topology_reduce() merges the nodes tied by such sources, every merged set
+   keeps one node (the ground node if the set has it) and the others become
+   offsets from it. 0 V sources collapse their nodes, nodes tied to ground
+   get a fixed voltage and go to the right hand side, the sources leave the
+   system.
+
+   The current of a removed source follows from the KCL of its nodes, see
+   topology_expand(). That needs the KCL to be static, sources on nodes
+   with capacitors (in a transient), transient or swept current sources are
+   kept, and so are transient or swept voltage sources.
+
+   With .option rcm the nodes left are relabeled in Reverse Cuthill-McKee
+   order and the branches follow their first node, see topology_rcm(). */
+
+struct topology {
+    int active;  //some source was removed, or the nodes were relabeled
+
+    //the full system
+    unsigned long n;  //nodes without the ground node
+    unsigned long el_group2_size;
+
+    unsigned long *node;    //nuid -> reduced nuid, 0 for the ground node
+    dfloat_t *node_offset;  //v(nuid) = v(node[nuid]) + node_offset[nuid]
+    unsigned long *branch;  //group2 idx -> reduced branch, ULONG_MAX if removed
+
+    //the reduced system, a shallow copy of the netlist but n,
+    //el_group2_size and devices
+    struct netlist_info netlist;
+    dfloat_t *rhs;  //folded into mna_vector, one per reduced row
+    unsigned long bandwidth[2];  //of the node couplings, before and after rcm
+
+    //the removed sources, leaves first, the parent of tree_node[k] is
+    //the other node of the source devices.v[tree_source[k]]
+    unsigned long tree_size;
+    unsigned long *tree_node;
+    unsigned long *tree_source;
+
+    int probed;     //some print/plot item reads a removed source
+    dfloat_t *x;    //the full solution vector, see topology_expand()
+    dfloat_t *kcl;  //scratch, one per node
+};
+
+void topology_reduce(struct netlist_info *netlist, struct topology *t,
+                     const int transient, struct element *swept,
+                     const int relabel);
+void topology_expand(struct netlist_info *netlist, struct topology *t,
+                     const dfloat_t *x);
+
+static inline unsigned long topology_node(const struct topology *t, unsigned long nuid) {
+    return t->active ? t->node[nuid] : nuid;
+}
+
+static inline unsigned long topology_branch(const struct topology *t, unsigned long idx) {
+    return t->active ? t->branch[idx] : idx;
+}
+
+#endif
@@ -92,23 +92,167 @@ dfloat_t analysis_transient_call_pulse(struct transient_pulse *data, const dfloa
     return out;
 }
 
+//forward steps of the cursor before falling back to binary search
+#define PWL_CURSOR_WALK 8
+
+static unsigned long pwl_search(struct transient_pwl_pair *pair,
+                                unsigned long lo, unsigned long hi,
+                                const dfloat_t time) {
+    //first i in [lo, hi] with time <= pair[i].time, pair[hi] qualifies
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo) / 2;
+        if (time <= pair[mid].time)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
 dfloat_t analysis_transient_call_pwl(struct transient_pwl *data, const dfloat_t abs_time) {
     const dfloat_t time = abs_time;
+    struct transient_pwl_pair *pair = data->pair;
+    const unsigned long last = data->next - 1;
     dfloat_t out;
 
-    if (time < data->pair[0].time)
-        return data->pair[0].value;
+    if (time < pair[0].time)
+        return pair[0].value;
+    if (time > pair[last].time || last == 0)
+        return pair[last].value;
 
-    unsigned long i;
-    for (i=1; i<data->next; ++i) {
-        if (time <= data->pair[i].time) {
-            out = linear(data->pair[i-1].value,data->pair[i].value,
-                         data->pair[i-1].time,data->pair[i].time,
-                         time);
-            return out;
+    //the segment pair[i-1].time < time <= pair[i].time, the time mostly
+    //moves forward so start from the one of the previous call
+    unsigned long i = data->cursor;
+    if (i < 1 || i > last || time <= pair[i-1].time)
+        i = pwl_search(pair,1,last,time);
+    else {
+        unsigned long walk = 0;
+        while (time > pair[i].time) {
+            if (++walk == PWL_CURSOR_WALK) {
+                i = pwl_search(pair,i,last,time);
+                break;
+            }
+            ++i;
         }
     }
+    data->cursor = i;
 
-    out = data->pair[data->next-1].value;
+    out = linear(pair[i-1].value,pair[i].value,
+                 pair[i-1].time,pair[i].time,
+                 time);
     return out;
 }
+
+unsigned long analysis_transient_breakpoints(struct _transient_ *tran,
+                                             const dfloat_t fin_time,
+                                             const dfloat_t min_dist,
+                                             dfloat_t *bp) {
+    //slope discontinuities of the waveform in (0, fin_time),
+    //just count them if bp is NULL
+    unsigned long size = 0;
+
+    switch (tran->type) {
+    case TR_EXP: {
+        struct transient_exp *data = &tran->data.exp;
+        if (bp) {
+            bp[0] = data->td1;
+            bp[1] = data->td2;
+        }
+        size = 2;
+        break;
+    }
+    case TR_SIN: {
+        struct transient_sin *data = &tran->data.sin;
+        if (bp)
+            bp[0] = data->td;
+        size = 1;
+        break;
+    }
+    case TR_PULSE: {
+        /* The corners of period k start at td + k * per. Corners closer
+           than min_dist to the previous one are dropped, a period shorter
+           than min_dist cannot be followed and only the first one counts.
+           At most fin_time / min_dist corners in all. */
+        struct transient_pulse *data = &tran->data.pulse;
+        const dfloat_t corner[4] = {
+            0,
+            data->tr,
+            data->tr + data->pw,
+            data->tr + data->pw + data->tf
+        };
+        const dfloat_t limit = fin_time / min_dist + 4;
+        dfloat_t last = -min_dist;
+        unsigned long k;
+        for (k=0; size < limit; ++k) {
+            dfloat_t start = data->td + k * data->per;
+            int c;
+            if (start >= fin_time)
+                break;
+            for (c=0; c<4; ++c) {
+                dfloat_t time = start + corner[c];
+                if (time - last < min_dist)
+                    continue;
+                if (bp)
+                    bp[size] = time;
+                size++;
+                last = time;
+            }
+            if (data->per < min_dist)
+                break;
+        }
+        break;
+    }
+    case TR_PWL: {
+        struct transient_pwl *data = &tran->data.pwl;
+        unsigned long i;
+        for (i=0; i<data->next; ++i) {
+            if (bp)
+                bp[size] = data->pair[i].time;
+            size++;
+        }
+        break;
+    }
+    }
+
+    return size;
+}
+
+/* Batch evaluation of type-homogeneous source arrays, out[i] is the value
+   of data[i]. Large batches are split across the OpenMP threads, every
+   thread writes its own range of out[], the result does not depend on
+   the thread count.
+*/
+
+#define BATCH_PARALLEL_MIN 4096
+
+void analysis_transient_eval_exp(struct transient_exp *data, const unsigned long size,
+                                 const dfloat_t abs_time, dfloat_t *out) {
+    long i;
+#pragma omp parallel for schedule(static) if (size >= BATCH_PARALLEL_MIN)
+    for (i=0; i<(long)size; ++i)
+        out[i] = analysis_transient_call_exp(&data[i],abs_time);
+}
+
+void analysis_transient_eval_sin(struct transient_sin *data, const unsigned long size,
+                                 const dfloat_t abs_time, dfloat_t *out) {
+    long i;
+#pragma omp parallel for schedule(static) if (size >= BATCH_PARALLEL_MIN)
+    for (i=0; i<(long)size; ++i)
+        out[i] = analysis_transient_call_sin(&data[i],abs_time);
+}
+
+void analysis_transient_eval_pulse(struct transient_pulse *data, const unsigned long size,
+                                   const dfloat_t abs_time, dfloat_t *out) {
+    long i;
+#pragma omp parallel for schedule(static) if (size >= BATCH_PARALLEL_MIN)
+    for (i=0; i<(long)size; ++i)
+        out[i] = analysis_transient_call_pulse(&data[i],abs_time);
+}
+
+void analysis_transient_eval_pwl(struct transient_pwl *data, const unsigned long size,
+                                 const dfloat_t abs_time, dfloat_t *out) {
+    long i;
+#pragma omp parallel for schedule(static) if (size >= BATCH_PARALLEL_MIN)
+    for (i=0; i<(long)size; ++i)
+        out[i] = analysis_transient_call_pwl(&data[i],abs_time);
+}
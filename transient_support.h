@@ -7,10 +7,25 @@ struct transient_exp;
 struct transient_sin;
 struct transient_pulse;
 struct transient_pwl;
+struct _transient_;
 
 dfloat_t analysis_transient_call_exp(struct transient_exp *data, const dfloat_t abs_time);
 dfloat_t analysis_transient_call_sin(struct transient_sin *data, const dfloat_t abs_time);
 dfloat_t analysis_transient_call_pulse(struct transient_pulse *data, const dfloat_t abs_time);
 dfloat_t analysis_transient_call_pwl(struct transient_pwl *data, const dfloat_t abs_time);
 
+void analysis_transient_eval_exp(struct transient_exp *data, const unsigned long size,
+                                 const dfloat_t abs_time, dfloat_t *out);
+void analysis_transient_eval_sin(struct transient_sin *data, const unsigned long size,
+                                 const dfloat_t abs_time, dfloat_t *out);
+void analysis_transient_eval_pulse(struct transient_pulse *data, const unsigned long size,
+                                   const dfloat_t abs_time, dfloat_t *out);
+void analysis_transient_eval_pwl(struct transient_pwl *data, const unsigned long size,
+                                 const dfloat_t abs_time, dfloat_t *out);
+
+unsigned long analysis_transient_breakpoints(struct _transient_ *tran,
+                                             const dfloat_t fin_time,
+                                             const dfloat_t min_dist,
+                                             dfloat_t *bp);
+
 #endif
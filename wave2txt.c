@@ -0,0 +1,101 @@
+#include "waveform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//convert a binary waveform file (.option binary) to the text log format
+
+static void read_or_die(void *p, size_t size, size_t n, FILE *f) {
+    if (fread(p,size,n,f) != n) {
+        printf("error: truncated waveform header - exit.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        printf("usage: %s <plot_XXXXX.bin> [output]\n",argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *in = fopen(argv[1],"rb");
+    if (!in) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *out = stdout;
+    if (argc == 3) {
+        out = fopen(argv[2],"w");
+        if (!out) {
+            perror(argv[2]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    setvbuf(in,NULL,_IOFBF,WAVEFORM_BUFFER_SIZE);
+    setvbuf(out,NULL,_IOFBF,WAVEFORM_BUFFER_SIZE);
+
+    char magic[WAVEFORM_MAGIC_SIZE];
+    uint32_t header[3];
+    read_or_die(magic,1,WAVEFORM_MAGIC_SIZE,in);
+    read_or_die(header,sizeof(uint32_t),3,in);
+    if (memcmp(magic,WAVEFORM_MAGIC,WAVEFORM_MAGIC_SIZE)) {
+        printf("error: %s is not a waveform file - exit.\n",argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    if (header[0] != WAVEFORM_VERSION) {
+        printf("error: unsupported waveform version %u - exit.\n",header[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (header[1] != WAVEFORM_BOM) {
+        printf("error: waveform written with a different byte order - exit.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t probes = header[2];
+    char **name = (char **)malloc(probes * sizeof(char *));
+    double *row = (double *)malloc((probes + 1) * sizeof(double));
+    if (!name || !row) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t j;
+    for (j=0; j<probes; ++j) {
+        uint32_t length;
+        read_or_die(&length,sizeof(uint32_t),1,in);
+        name[j] = (char *)malloc(length + 1);
+        if (!name[j]) {
+            perror(__FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        read_or_die(name[j],1,length,in);
+        name[j][length] = '\0';
+    }
+
+    //same lines as write_result()
+    while (fread(row,sizeof(double),probes + 1,in) == probes + 1)
+        for (j=0; j<probes; ++j)
+            if (fprintf(out,"%s : %5.3f : %+e\n",name[j],row[0],row[j + 1]) < 0) {
+                perror(__FUNCTION__);
+                exit(EXIT_FAILURE);
+            }
+
+    if (ferror(in)) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    if (fclose(out) == EOF) {
+        perror(__FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    fclose(in);
+
+    for (j=0; j<probes; ++j)
+        free(name[j]);
+    free(name);
+    free(row);
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef _WAVEFORM_H_
+#define _WAVEFORM_H_
+
+#include <stdint.h>
+
+/* Binary waveform file (.option binary), one per .plot/.print command.
+   Everything is in the byte order of the machine that wrote it, the
+   reader checks it with the byte order mark.
+
+       char     magic[8]          WAVEFORM_MAGIC
+       uint32_t version           WAVEFORM_VERSION
+       uint32_t bom               WAVEFORM_BOM
+       uint32_t probes
+       probes times:
+           uint32_t length
+           char     name[length]  (no '\0')
+       until EOF, one row per timestep / dc point:
+           double   time
+           double   value[probes]
+*/
+
+#define WAVEFORM_MAGIC "CAPERWAV"
+#define WAVEFORM_MAGIC_SIZE 8
+#define WAVEFORM_VERSION 1
+#define WAVEFORM_BOM 0x01020304
+
+//stdio buffer of every log file, a row is written with one fwrite()
+#define WAVEFORM_BUFFER_SIZE (1 << 20)
+
+#endif